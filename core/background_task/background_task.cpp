@@ -13,6 +13,7 @@ void BackgroundTask::update(int percent)
 {
 #ifdef WITH_QT
 	emit progress(description, percent);
+	emit progressChanged(percent);
 #endif
 }
 
@@ -25,6 +26,7 @@ void BackgroundTask::done(bool success)
 	future.notify_all();
 #ifdef WITH_QT
 	emit progress(description, 100);
+	emit progressChanged(100);
 	emit finished(success);
 #endif
 }
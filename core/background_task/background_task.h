@@ -59,6 +59,8 @@ public:
 signals:
 	/** Optional progress updates for asynchronous listeners. */
 	void progress(std::string &description, int percent);
+	/** Progress updates without description, usable across threads. */
+	void progressChanged(int percent);
 	/** Compulsory completion notification for asynchronous listeners. */
 	void finished(bool success);
 #endif
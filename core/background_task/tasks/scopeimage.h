@@ -8,7 +8,13 @@ public:
 	virtual ~ScopeImage() {}
 	virtual bool run() {
 		// using SharedData<multi_img_base>::getBase() to get multi_img_base object
-		multi_img *target =  new multi_img(full->getBase(), roi);
+		multi_img_base &base = full->getBase();
+		/* fill the region in the full image's cache, so the scoped image
+		   shares it instead of building its own */
+		multi_img *parent = dynamic_cast<multi_img*>(&base);
+		if (parent)
+			parent->rebuildPixels(roi);
+		multi_img *target =  new multi_img(base, roi);
 		SharedDataSwapLock lock(scoped->mutex);
 		scoped->replace(target);
 		return true;
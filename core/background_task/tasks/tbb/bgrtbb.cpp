@@ -14,6 +14,28 @@
 bool BgrTbb::run()
 {
 		multi_img_base& source = multi->getBase();
+
+		/* with all bands in memory, compute in a single fused pass */
+		if (dynamic_cast<multi_img*>(&source)) {
+			std::vector<multi_img::Band> bands(source.size());
+			for (unsigned int i = 0; i < source.size(); ++i)
+				source.getBand(i, bands[i]);
+
+			cv::Mat_<cv::Vec3f> *newBgr = new cv::Mat_<cv::Vec3f>(source.height, source.width);
+			XyzBgr computeBgr(bands, source.meta, source.maxval, *newBgr);
+			tbb::parallel_for(tbb::blocked_range2d<int>(0, newBgr->rows, 16,
+			                                            0, newBgr->cols, XyzBgr::TILE),
+				computeBgr, tbb::auto_partitioner(), stopper);
+
+			if (stopper.is_group_execution_cancelled()) {
+				delete newBgr;
+				return false;
+			}
+			SharedDataSwapLock lock(bgr->mutex);
+			bgr->replace(newBgr);
+			return true;
+		}
+
 		cv::Mat_<cv::Vec3f> xyz(source.height, source.width, 0.);
 		float greensum = 0.f;
 		for (unsigned int i = 0; i < source.size(); ++i) {
@@ -31,6 +53,8 @@ bool BgrTbb::run()
 
 			if (stopper.is_group_execution_cancelled())
 				break;
+			// bands may come from disk one by one, report progress
+			update((int)((i + 1) * 100 / source.size()));
 		}
 
 		if (greensum == 0.f)
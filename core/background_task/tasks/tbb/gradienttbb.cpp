@@ -54,39 +54,23 @@ bool GradientTbb::run()
 
 	Stopwatch s;
 
+	// log and gradient in one pass, directly on the rectangles to compute
 	std::vector<cv::Rect>::iterator it;
-	multi_img temp((*source)->height, (*source)->width, (*source)->size());
 	for (it = calc.begin(); it != calc.end(); ++it) {
 		if (it->width > 0 && it->height > 0) {
-			multi_img srcScope(**source, *it);
-			multi_img tmpScope(temp, *it);
-			Log computeLog(srcScope, tmpScope);
-			tbb::parallel_for(tbb::blocked_range<size_t>(0, temp.size()),
-				computeLog, tbb::auto_partitioner(), stopper);
+			LogGrad computeGradient(**source, *target);
+			tbb::parallel_for(tbb::blocked_range2d<int>(
+				it->y, it->y + it->height, 16,
+				it->x, it->x + it->width, LogGrad::TILE),
+				computeGradient, tbb::auto_partitioner(), stopper);
 		}
 
 		if (stopper.is_group_execution_cancelled())
 			break;
 	}
-	temp.minval = 0.;
-	temp.maxval = log((*source)->maxval);
-	temp.roi = (*source)->roi;
-
-	for (it = calc.begin(); it != calc.end(); ++it) {
-		if (it->width > 0 && it->height > 0) {
-			multi_img tmpScope(temp, *it);
-			multi_img tgtScope(*target, *it);
-			Grad computeGrad(tmpScope, tgtScope);
-			tbb::parallel_for(tbb::blocked_range<size_t>(0, target->size()),
-				computeGrad, tbb::auto_partitioner(), stopper);
-		}
-
-		if (stopper.is_group_execution_cancelled())
-			break;
-	}
-	target->minval = -temp.maxval;
-	target->maxval = temp.maxval;
-	target->roi = temp.roi;
+	target->maxval = log((*source)->maxval);
+	target->minval = -target->maxval;
+	target->roi = (*source)->roi;
 
 	// init multi_img::meta
 	for (unsigned int i = 0; i < (*source)->size()-1; ++i) {
@@ -101,10 +85,10 @@ bool GradientTbb::run()
 
 	if (includecache) {
 		RebuildPixels rebuildPixels(*target);
-		tbb::parallel_for(tbb::blocked_range<size_t>(0, target->size()),
+		tbb::parallel_for(tbb::blocked_range2d<int>(0, target->height,
+		                                            0, target->width),
 			rebuildPixels, tbb::auto_partitioner(), stopper);
-		target->dirty.setTo(0);
-		target->anydirt = false;
+		target->validatePixels();
 	} else {
 		target->resetPixels();
 	}
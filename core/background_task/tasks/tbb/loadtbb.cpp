@@ -0,0 +1,120 @@
+#include <shared_data.h>
+
+#include <background_task/background_task.h>
+
+#include "multi_img/multi_img_mapped.h"
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <algorithm>
+#include <limits>
+
+#include "loadtbb.h"
+
+bool LoadTbb::run()
+{
+	const multi_img_base &source = image->getBase();
+	const multi_img_mapped *mapped =
+	        dynamic_cast<const multi_img_mapped*>(&source);
+	const int width = source.width, height = source.height;
+	const size_t bands = source.size();
+	if (source.empty())
+		return false;
+
+	multi_img *target = new multi_img(height, width, bands);
+	target->minval = source.minval;
+	target->maxval = source.maxval;
+	target->meta = source.meta;
+
+	// same geometry as multi_img_pyramid::subsample()
+	const int step = std::max(1, (std::max(width, height) + maxSide - 1)
+	                             / maxSide);
+	multi_img *thumb = new multi_img((height + step - 1) / step,
+	                                 (width + step - 1) / step, bands);
+	thumb->minval = source.minval;
+	thumb->maxval = source.maxval;
+	thumb->meta = source.meta;
+	for (size_t d = 0; d < bands; ++d)
+		thumb->bands[d].setTo(source.minval);
+	thumb->resetPixels();
+	{
+		SharedDataSwapLock lock(preview->mutex);
+		preview->replace(thumb);
+	}
+
+	std::vector<multi_img::Value>
+	        bandMin(bands, std::numeric_limits<multi_img::Value>::max()),
+	        bandMax(bands, -std::numeric_limits<multi_img::Value>::max());
+
+	// about 100 stripes for progress, but not too thin for the file reads
+	const int stripe = std::max(32, (height + 99) / 100);
+	for (int y0 = 0; y0 < height; y0 += stripe) {
+		const int y1 = std::min(height, y0 + stripe);
+		const cv::Rect roi(0, y0, width, y1 - y0);
+
+		// views into the target, filled in place
+		std::vector<multi_img::Band> parts(bands);
+		for (size_t d = 0; d < bands; ++d)
+			parts[d] = target->bands[d].rowRange(y0, y1);
+
+		if (mapped) {
+			mapped->readRegion(roi, 0, parts);
+		} else {
+			tbb::parallel_for(tbb::blocked_range<size_t>(0, bands, 1),
+				[&](const tbb::blocked_range<size_t> &r) {
+					for (size_t d = r.begin(); d != r.end(); ++d) {
+						multi_img::Band part;
+						source.getBandRegion(d, roi, part);
+						part.copyTo(parts[d]);
+					}
+				}, tbb::auto_partitioner(), stopper);
+		}
+
+		tbb::parallel_for(tbb::blocked_range<size_t>(0, bands, 1),
+			[&](const tbb::blocked_range<size_t> &r) {
+				for (size_t d = r.begin(); d != r.end(); ++d) {
+					double lo, hi;
+					cv::minMaxLoc(parts[d], &lo, &hi);
+					bandMin[d] = std::min(bandMin[d], (multi_img::Value)lo);
+					bandMax[d] = std::max(bandMax[d], (multi_img::Value)hi);
+				}
+			}, tbb::auto_partitioner(), stopper);
+
+		if (stopper.is_group_execution_cancelled()) {
+			delete target;
+			return false;
+		}
+
+		multi_img::Value lo = *std::min_element(bandMin.begin(), bandMin.end());
+		multi_img::Value hi = *std::max_element(bandMax.begin(), bandMax.end());
+
+		// preview rows that fall into this stripe
+		{
+			SharedDataSwapLock lock(preview->mutex);
+			thumb->fitRange(multi_img::Range(lo, hi));
+			thumb->detachBands();
+			for (int y = ((y0 + step - 1) / step) * step; y < y1; y += step) {
+				for (size_t d = 0; d < bands; ++d) {
+					const multi_img::Value *src = target->bands[d][y];
+					multi_img::Value *dst = thumb->bands[d][y / step];
+					for (int x = 0, px = 0; x < width; x += step, ++px)
+						dst[px] = src[x];
+				}
+			}
+			thumb->resetPixels();
+		}
+
+		update((int)((long long)y1 * 99 / height));
+	}
+
+	if (bands > 0 && height > 0)
+		target->fitRange(multi_img::Range(
+		        *std::min_element(bandMin.begin(), bandMin.end()),
+		        *std::max_element(bandMax.begin(), bandMax.end())));
+	target->roi = cv::Rect(0, 0, width, height);
+	target->resetPixels();
+
+	SharedDataSwapLock lock(image->mutex);
+	image->replace(target);
+	return true;
+}
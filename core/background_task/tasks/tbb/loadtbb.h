@@ -0,0 +1,32 @@
+#ifndef LOADTBB_H
+#define LOADTBB_H
+
+#include <tbb/task_group.h>
+
+/** reads a lazily opened image (e.g. multi_img_mapped) into memory
+ *
+ * The image is read in stripes of rows, progress is reported via update().
+ * preview is set up front to a subsample of at most maxSide pixels along
+ * each side (as multi_img_pyramid::subsample) and filled as the rows arrive.
+ * When all rows are read, the value range is widened by powers of two to
+ * cover the data, like the image readers do, and image is replaced with the
+ * in-memory copy.
+ */
+class LoadTbb : public BackgroundTask {
+public:
+	LoadTbb(SharedMultiImgPtr image, SharedMultiImgPtr preview,
+	        int maxSide = 512)
+		: BackgroundTask(), image(image), preview(preview),
+		  maxSide(maxSide) {}
+	virtual ~LoadTbb() {}
+	virtual bool run();
+	virtual void cancel() { stopper.cancel_group_execution(); }
+protected:
+	tbb::task_group_context stopper;
+
+	SharedMultiImgPtr image;
+	SharedMultiImgPtr preview;
+	int maxSide;
+};
+
+#endif // LOADTBB_H
@@ -64,16 +64,11 @@ bool NormL2Tbb::run()
 	std::vector<cv::Rect>::iterator it;
 	for (it = calc.begin(); it != calc.end(); ++it) {
 		if (it->width > 0 && it->height > 0) {
-			NormL2 computeNormL2(**source, *target);
+			// writes the new vectors to band data directly
+			NormL2 computeNormL2(**source, *target, true);
 			tbb::parallel_for(tbb::blocked_range2d<int>(it->y, it->br().y,
 			                                            it->x, it->br().x),
 				computeNormL2, tbb::auto_partitioner(), stopper);
-
-			// apply the new vectors to band data
-			ApplyCache applyCache(*target);
-			tbb::parallel_for(tbb::blocked_range2d<int>(it->y, it->br().y,
-			                                            it->x, it->br().x),
-				applyCache, tbb::auto_partitioner(), stopper);
 		}
 
 		if (stopper.is_group_execution_cancelled())
@@ -81,8 +76,7 @@ bool NormL2Tbb::run()
 	}
 
 	/* we either rebuilt the pixels, or had computation happen in the cache. */
-	target->dirty.setTo(0);
-	target->anydirt = false;
+	target->validatePixels();
 
 	target->minval = 0.f;
 	target->maxval = 1.f;
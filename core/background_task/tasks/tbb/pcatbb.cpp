@@ -11,22 +11,27 @@
 
 bool PcaTbb::run()
 {
-	cv::Mat_<multi_img::Value> pixels(
-		(*source)->size(), (*source)->width * (*source)->height);
-	MultiImg2BandMat computePixels(**source, pixels);
-	tbb::parallel_for(tbb::blocked_range<size_t>(0, (*source)->size()),
-		computePixels, tbb::auto_partitioner(), stopper);
+	// accumulate statistics of (sampled) pixels, no copy of the data
+	int step = (*source)->pca_sample_step(maxSamples);
+	Covariance cov(**source, step);
+	tbb::parallel_reduce(tbb::blocked_range<int>(0,
+	                         Covariance::sampledRows(**source, step)),
+		cov, tbb::auto_partitioner(), stopper);
+	if (stopper.is_group_execution_cancelled())
+		return false;
 
-	cv::PCA pca(pixels, cv::noArray(), CV_PCA_DATA_AS_COL, (int)components);
+	cv::PCA pca = multi_img::pca_solve(cov.sum, cov.scatter, cov.count,
+	                                   components, randomized);
 
 	multi_img *target = new multi_img(
 		(*source)->height, (*source)->width, pca.eigenvectors.rows);
-	PcaProjection computeProjection(pixels, *target, pca);
-	tbb::parallel_for(tbb::blocked_range<size_t>(0, target->pixels.size()),
+	PcaProjection computeProjection(**source, *target, pca);
+	tbb::parallel_for(tbb::blocked_range<int>(0, target->height),
 		computeProjection, tbb::auto_partitioner(), stopper);
 
 	ApplyCache applyCache(*target);
-	tbb::parallel_for(tbb::blocked_range<size_t>(0, target->size()),
+	tbb::parallel_for(tbb::blocked_range2d<int>(0, target->height,
+	                                            0, target->width),
 		applyCache, tbb::auto_partitioner(), stopper);
 
 	DetermineRange determineRange(*target);
@@ -34,8 +39,7 @@ bool PcaTbb::run()
 		determineRange, tbb::auto_partitioner(), stopper);
 
 	if (!stopper.is_group_execution_cancelled()) {
-		target->dirty.setTo(0);
-		target->anydirt = false;
+		target->validatePixels();
 		target->minval = determineRange.GetMin();
 		target->maxval = determineRange.GetMax();
 		target->roi = (*source)->roi;
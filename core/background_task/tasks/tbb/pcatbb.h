@@ -3,10 +3,13 @@
 
 class PcaTbb : public BackgroundTask {
 public:
+	/// maxSamples and randomized: see multi_img::pca()
 	PcaTbb(SharedMultiImgPtr source, SharedMultiImgPtr current,
-		   unsigned int components = 0, bool includecache = true)
+		   unsigned int components = 0, bool includecache = true,
+		   size_t maxSamples = 0, bool randomized = false)
 		: BackgroundTask(), source(source), current(current),
-		components(components), includecache(includecache) {}
+		components(components), includecache(includecache),
+		maxSamples(maxSamples), randomized(randomized) {}
 	virtual ~PcaTbb() {}
 	virtual bool run();
 	virtual void cancel() { stopper.cancel_group_execution(); }
@@ -17,6 +20,8 @@ protected:
 	SharedMultiImgPtr current;
 	unsigned int components;
 	bool includecache;
+	size_t maxSamples;
+	bool randomized;
 };
 
 #endif // PCATBB_H
@@ -0,0 +1,22 @@
+#include <shared_data.h>
+
+#include <background_task/background_task.h>
+
+#include "multi_img/multi_img_pyramid.h"
+
+#include "previewtbb.h"
+
+bool PreviewTbb::run()
+{
+	multi_img *preview =
+	        multi_img_pyramid::subsample(source->getBase(), maxSide, stopper);
+
+	if (!preview || stopper.is_group_execution_cancelled()) {
+		delete preview;
+		return false;
+	}
+
+	SharedDataSwapLock lock(target->mutex);
+	target->replace(preview);
+	return true;
+}
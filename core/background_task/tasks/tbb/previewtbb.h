@@ -0,0 +1,24 @@
+#ifndef PREVIEWTBB_H
+#define PREVIEWTBB_H
+
+#include <tbb/task_group.h>
+
+/// fills target with a subsample of source, see multi_img_pyramid::subsample
+class PreviewTbb : public BackgroundTask {
+public:
+	PreviewTbb(SharedMultiImgPtr source, SharedMultiImgPtr target,
+	           int maxSide = 512)
+		: BackgroundTask(), source(source), target(target),
+		  maxSide(maxSide) {}
+	virtual ~PreviewTbb() {}
+	virtual bool run();
+	virtual void cancel() { stopper.cancel_group_execution(); }
+protected:
+	tbb::task_group_context stopper;
+
+	SharedMultiImgPtr source;
+	SharedMultiImgPtr target;
+	int maxSide;
+};
+
+#endif // PREVIEWTBB_H
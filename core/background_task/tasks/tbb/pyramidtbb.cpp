@@ -0,0 +1,38 @@
+#include <shared_data.h>
+
+#include <background_task/background_task.h>
+
+#include "multi_img/multi_img_pyramid.h"
+
+#include "pyramidtbb.h"
+
+bool PyramidTbb::run()
+{
+	SharedMultiImgPtr previous = source;
+	for (size_t i = 0; i < levels.size(); ++i) {
+		// levels left over from an earlier run are reused
+		SharedDataLock hlock(levels[i]->mutex);
+		bool filled = !levels[i]->getBase().empty();
+		hlock.unlock();
+		if (filled) {
+			previous = levels[i];
+			continue;
+		}
+
+		multi_img *level =
+		        multi_img_pyramid::downsample(previous->getBase(), stopper);
+
+		if (!level || stopper.is_group_execution_cancelled()) {
+			delete level;
+			return false;
+		}
+
+		SharedDataSwapLock lock(levels[i]->mutex);
+		levels[i]->replace(level);
+		lock.unlock();
+
+		previous = levels[i];
+		update((int)((i + 1) * 100 / levels.size()));
+	}
+	return true;
+}
@@ -0,0 +1,27 @@
+#ifndef PYRAMIDTBB_H
+#define PYRAMIDTBB_H
+
+#include <tbb/task_group.h>
+#include <vector>
+
+/** fills levels[i] with source downsampled by 2^(i+1), see multi_img_pyramid
+ *
+ * Levels that are not empty are kept, so the task can be pushed again to
+ * complete a pyramid that was cancelled halfway.
+ */
+class PyramidTbb : public BackgroundTask {
+public:
+	PyramidTbb(SharedMultiImgPtr source,
+	           const std::vector<SharedMultiImgPtr> &levels)
+		: BackgroundTask(), source(source), levels(levels) {}
+	virtual ~PyramidTbb() {}
+	virtual bool run();
+	virtual void cancel() { stopper.cancel_group_execution(); }
+protected:
+	tbb::task_group_context stopper;
+
+	SharedMultiImgPtr source;
+	std::vector<SharedMultiImgPtr> levels;
+};
+
+#endif // PYRAMIDTBB_H
@@ -16,11 +16,8 @@ bool RescaleTbb::run()
 	multi_img *temp = new multi_img(**source,
 		cv::Rect(0, 0, (*source)->width, (*source)->height));
 	temp->roi = (*source)->roi;
-	RebuildPixels rebuildPixels(*temp);
-	tbb::parallel_for(tbb::blocked_range<size_t>(0, temp->size()),
-		rebuildPixels, tbb::auto_partitioner(), stopper);
-	temp->dirty.setTo(0);
-	temp->anydirt = false;
+	// no-op when the view shares a valid cache with the source
+	temp->rebuildPixels();
 
 	multi_img *target = NULL;
 	if (newsize != temp->size()) {
@@ -29,28 +26,21 @@ bool RescaleTbb::run()
 		target->minval = temp->minval;
 		target->maxval = temp->maxval;
 		target->roi = temp->roi;
-		Resize computeResize(*temp, *target, newsize);
+		// the band mapping is the same for all pixels, compute it once
+		multi_img::Resampling resampling(temp->size(), newsize);
+		Resize computeResize(*temp, *target, resampling);
 		tbb::parallel_for(tbb::blocked_range2d<int>(0, temp->height,
 		                                            0, temp->width),
 			computeResize, tbb::auto_partitioner(), stopper);
 
 		ApplyCache applyCache(*target);
-		tbb::parallel_for(tbb::blocked_range<size_t>(0, target->size()),
+		tbb::parallel_for(tbb::blocked_range2d<int>(0, target->height,
+		                                            0, target->width),
 			applyCache, tbb::auto_partitioner(), stopper);
-		target->dirty.setTo(0);
-		target->anydirt = false;
+		target->validatePixels();
 
 		if (!stopper.is_group_execution_cancelled()) {
-			cv::Mat_<float> tmpmeta1(cv::Size(temp->meta.size(), 1)), tmpmeta2;
-			std::vector<multi_img::BandDesc>::const_iterator it;
-			unsigned int i;
-			for (it = temp->meta.begin(), i = 0; it != temp->meta.end(); it++, i++) {
-				tmpmeta1(0, i) = it->center;
-			}
-			cv::resize(tmpmeta1, tmpmeta2, cv::Size(newsize, 1));
-			for (size_t b = 0; b < newsize; b++) {
-				target->meta[b] = multi_img::BandDesc(tmpmeta2(0, b));
-			}
+			resampling.apply(temp->meta, target->meta);
 		}
 
 		delete temp;
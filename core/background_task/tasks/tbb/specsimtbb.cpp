@@ -11,16 +11,22 @@
 
 bool SpecSimTbb::run()
 {
+	// dirty tiles must not be rebuilt concurrently inside the loop
+	(*multi)->rebuildPixels();
+
 	multi_img::Band result((*multi)->height, (*multi)->width);
-	const multi_img::Pixel& reference = (**multi)(coord.y,coord.x);
+	const multi_img::Pixel reference = (**multi)(coord.y,coord.x);
 
 	tbb::parallel_for(tbb::blocked_range2d<size_t>(
 						  0, (*multi)->height, 0, (*multi)->width),
 					  [&](tbb::blocked_range2d<size_t> r) {
+		// distance functions work on vectors, reuse one buffer per range
+		multi_img::Pixel pixel;
 		for (size_t y = r.rows().begin(); y != r.rows().end(); ++y) {
 			for (size_t x = r.cols().begin(); x != r.cols().end(); ++x) {
+				(**multi)(y,x).copyTo(pixel);
 				// negate so small values get high response
-				result(y,x) = -1.f*(float)distfun->getSimilarity((**multi)(y,x), reference);
+				result(y,x) = -1.f*(float)distfun->getSimilarity(pixel, reference);
 			}
 		}
 	});
@@ -0,0 +1,345 @@
+#include "derived_cache.h"
+#include "hashes.h"
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#ifdef WITH_BOOST_FILESYSTEM
+	#include "boost/filesystem.hpp"
+#endif
+#ifdef __unix__
+	#include <cerrno>
+	#include <dirent.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+	#include <utime.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+// bump when the layout of cached data changes
+const char *cacheVersion = "2";
+
+// files are hashed in blocks of this size
+const size_t hashBlock = 1 << 20;
+
+// default size limit of the cache in MiB
+const unsigned long long defaultLimit = 1024;
+
+// a file in the cache directory
+struct FileInfo {
+	FileInfo() : size(0), mtime(0) {}
+	std::string name;
+	unsigned long long size;
+	std::time_t mtime;
+};
+
+bool createDirectories(const std::string &dir)
+{
+#ifdef WITH_BOOST_FILESYSTEM
+	boost::system::error_code ec;
+	boost::filesystem::create_directories(dir, ec);
+	return boost::filesystem::is_directory(dir);
+#elif __unix__
+	for (std::string::size_type pos = 1; pos != std::string::npos; ++pos) {
+		pos = dir.find('/', pos);
+		std::string part = dir.substr(0, pos);
+		if (mkdir(part.c_str(), 0777) != 0 && errno != EEXIST)
+			return false;
+		if (pos == std::string::npos)
+			break;
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+// regular files in dir
+std::vector<FileInfo> listFiles(const std::string &dir)
+{
+	std::vector<FileInfo> ret;
+#ifdef WITH_BOOST_FILESYSTEM
+	namespace fs = boost::filesystem;
+	boost::system::error_code ec;
+	for (fs::directory_iterator it(dir, ec), end; !ec && it != end;
+	     it.increment(ec)) {
+		if (!fs::is_regular_file(it->status()))
+			continue;
+		FileInfo f;
+		f.name = it->path().filename().string();
+		f.size = fs::file_size(it->path(), ec);
+		f.mtime = fs::last_write_time(it->path(), ec);
+		ret.push_back(f);
+	}
+#elif __unix__
+	DIR *d = opendir(dir.c_str());
+	if (!d)
+		return ret;
+	while (struct dirent *e = readdir(d)) {
+		struct stat st;
+		std::string file = dir + "/" + e->d_name;
+		if (stat(file.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+			continue;
+		FileInfo f;
+		f.name = e->d_name;
+		f.size = st.st_size;
+		f.mtime = st.st_mtime;
+		ret.push_back(f);
+	}
+	closedir(d);
+#endif
+	return ret;
+}
+
+// set modification time to now
+void touch(const std::string &file)
+{
+#ifdef WITH_BOOST_FILESYSTEM
+	boost::system::error_code ec;
+	boost::filesystem::last_write_time(file, std::time(NULL), ec);
+#elif __unix__
+	utime(file.c_str(), NULL);
+#endif
+}
+
+bool endsWith(const std::string &s, const std::string &suffix)
+{
+	return s.size() >= suffix.size()
+	        && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+std::string hex(unsigned long long hash)
+{
+	std::ostringstream s;
+	s << std::hex << std::setfill('0') << std::setw(16) << hash;
+	return s.str();
+}
+
+// fingerprint of one file
+std::string fileFingerprint(const std::string &filename)
+{
+	std::ostringstream s;
+	s << filename;
+	std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+	if (!in) {
+		s << " missing\n";
+		return s.str();
+	}
+	in.seekg(0, std::ios::end);
+	const unsigned long long length = in.tellg();
+	s << " " << length;
+#ifdef __unix__
+	struct stat st;
+	if (stat(filename.c_str(), &st) == 0)
+		s << " " << (long long)st.st_mtime;
+#endif
+
+	// hash the complete content
+	std::vector<char> buf(hashBlock);
+	unsigned long long hash = 5381;
+	in.seekg(0);
+	while (in.read(buf.data(), buf.size()) || in.gcount() > 0)
+		hash = Hashes::djb2(buf.data(), (size_t)in.gcount(), hash);
+	s << " " << hex(hash) << "\n";
+	return s.str();
+}
+
+}
+
+DerivedCache::DerivedCache()
+	: limit(defaultLimit << 20)
+{
+	const char *env = getenv("GERBIL_CACHE_DIR");
+	if (!env || !*env)
+		return;
+	std::string d = env;
+
+	if ((env = getenv("GERBIL_CACHE_LIMIT")) && *env)
+		limit = strtoull(env, NULL, 10) << 20;
+
+	if (createDirectories(d))
+		dir = d;
+	else
+		std::cerr << "Warning: cache directory " << d
+		          << " not available, caching disabled." << std::endl;
+}
+
+std::string DerivedCache::inputFingerprint(
+        const std::vector<std::string> &files)
+{
+	std::string ret;
+	for (size_t i = 0; i < files.size(); ++i)
+		ret += fileFingerprint(files[i]);
+	return ret;
+}
+
+std::string DerivedCache::imageFingerprint(const multi_img_base &img)
+{
+	// hash bands in parallel, then combine in order
+	std::vector<unsigned long long> bandHashes(img.size());
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, img.size(), 1),
+		[&](const tbb::blocked_range<size_t> &r) {
+			for (size_t d = r.begin(); d != r.end(); ++d) {
+				multi_img::Band band;
+				img.getBand(d, band);
+				unsigned long long h = 5381;
+				for (int y = 0; y < band.rows; ++y)
+					h = Hashes::djb2(band[y], band.cols * sizeof(multi_img::Value), h);
+				bandHashes[d] = h;
+			}
+		});
+
+	unsigned long long hash = 5381;
+	for (size_t d = 0; d < bandHashes.size(); ++d)
+		hash = Hashes::djb2(&bandHashes[d], sizeof(bandHashes[d]), hash);
+	for (size_t d = 0; d < img.meta.size(); ++d)
+		hash = Hashes::djb2(&img.meta[d].center, sizeof(float), hash);
+
+	std::ostringstream s;
+	s << "image " << img.width << "x" << img.height << "x" << img.size()
+	  << " " << img.minval << " " << img.maxval << " " << hex(hash) << "\n";
+	return s.str();
+}
+
+DerivedCache::Key DerivedCache::key(const std::string &input,
+                                    const std::string &params)
+{
+	Key ret;
+	ret.description = std::string("gerbil derived cache ") + cacheVersion
+	        + "\n" + input + params + "\n";
+	ret.name = hex(Hashes::djb2(input.data(), input.size())) + "-"
+	        + hex(Hashes::djb2(ret.description.data(),
+	                           ret.description.size()));
+	return ret;
+}
+
+std::string DerivedCache::path(const Key &key, const std::string &ext) const
+{
+	if (!enabled())
+		return std::string();
+	return dir + "/" + key.name + "." + ext;
+}
+
+std::string DerivedCache::tempPath(const Key &key,
+                                   const std::string &ext) const
+{
+	std::ostringstream s;
+	s << path(key, ext) << ".tmp";
+#ifdef __unix__
+	// concurrent writers must not share a file
+	s << getpid();
+#endif
+	return s.str();
+}
+
+bool DerivedCache::commit(const Key &key, const std::string &ext) const
+{
+	if (!enabled())
+		return false;
+	std::string tmp = tempPath(key, ext);
+	std::string metaTmp = tempPath(key, ext + ".meta");
+	{
+		std::ofstream meta(metaTmp.c_str(), std::ios::out | std::ios::binary);
+		meta << key.description;
+	}
+	/* data first: in between, the old description does not match and
+	   readers miss instead of taking new data for the old entry */
+	if (std::rename(tmp.c_str(), path(key, ext).c_str()) != 0
+	    || std::rename(metaTmp.c_str(), path(key, ext + ".meta").c_str()) != 0) {
+		std::remove(tmp.c_str());
+		std::remove(metaTmp.c_str());
+		return false;
+	}
+	evict();
+	return true;
+}
+
+bool DerivedCache::contains(const Key &key, const std::string &ext) const
+{
+	if (!enabled() || !std::ifstream(path(key, ext).c_str()).good())
+		return false;
+
+	std::ifstream meta(path(key, ext + ".meta").c_str(),
+	                   std::ios::in | std::ios::binary);
+	std::string description((std::istreambuf_iterator<char>(meta)),
+	                        std::istreambuf_iterator<char>());
+	if (description != key.description)
+		return false;
+
+	touch(path(key, ext));
+	return true;
+}
+
+bool DerivedCache::load(const Key &key, multi_img &img) const
+{
+	if (!contains(key, "cube"))
+		return false;
+	if (!img.read_image_cube(path(key, "cube")) || img.empty()) {
+		img = multi_img();
+		return false;
+	}
+	return true;
+}
+
+bool DerivedCache::store(const Key &key, const multi_img &img) const
+{
+	if (!enabled())
+		return false;
+	if (!img.write_cube(tempPath(key, "cube"))) {
+		std::remove(tempPath(key, "cube").c_str());
+		return false;
+	}
+	return commit(key, "cube");
+}
+
+void DerivedCache::evict() const
+{
+	// entries by name of their data file, the description belongs to it
+	std::map<std::string, FileInfo> entries;
+	unsigned long long total = 0;
+	std::vector<FileInfo> files = listFiles(dir);
+	for (size_t i = 0; i < files.size(); ++i) {
+		const FileInfo &f = files[i];
+		total += f.size;
+		// files of running writers are theirs to clean up
+		if (f.name.find(".tmp") != std::string::npos)
+			continue;
+		bool meta = endsWith(f.name, ".meta");
+		std::string name = (meta ? f.name.substr(0, f.name.size() - 5)
+		                         : f.name);
+		FileInfo &e = entries[name];
+		if (e.name.empty() || !meta)
+			e.mtime = f.mtime;
+		e.name = name;
+		e.size += f.size;
+	}
+	if (total <= limit)
+		return;
+
+	std::vector<FileInfo> lru;
+	for (std::map<std::string, FileInfo>::const_iterator it = entries.begin();
+	     it != entries.end(); ++it)
+		lru.push_back(it->second);
+	std::sort(lru.begin(), lru.end(),
+	          [](const FileInfo &a, const FileInfo &b) {
+		return a.mtime < b.mtime;
+	});
+	for (size_t i = 0; i < lru.size() && total > limit; ++i) {
+		std::remove((dir + "/" + lru[i].name).c_str());
+		std::remove((dir + "/" + lru[i].name + ".meta").c_str());
+		total -= std::min(total, lru[i].size);
+	}
+}
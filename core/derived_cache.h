@@ -0,0 +1,77 @@
+#ifndef DERIVED_CACHE_H
+#define DERIVED_CACHE_H
+
+#include <multi_img.h>
+#include <string>
+#include <vector>
+
+/** On-disk cache for data derived from input images.
+ *
+ * Entries are keyed by a fingerprint of the input and a description of all
+ * parameters that determine the result. Next to each entry, the full
+ * description is stored and compared on lookup, so a hash collision or a
+ * changed input is a miss instead of a wrong result. Images are stored as
+ * native cube files, which are read back through a memory mapping. Other
+ * artifacts are written by their owner to tempPath() and published with
+ * commit(), so readers never see partially written entries.
+ *
+ * The cache is opt-in: it lives in $GERBIL_CACHE_DIR and is disabled if that
+ * is not set. It holds at most $GERBIL_CACHE_LIMIT MiB (default 1024), least
+ * recently used entries are removed on commit().
+ */
+class DerivedCache {
+public:
+	/// identifies an entry
+	struct Key {
+		/// file name of the entry, derived from description
+		std::string name;
+		/// input fingerprint and parameters the entry is derived from
+		std::string description;
+
+		bool empty() const { return name.empty(); }
+	};
+
+	DerivedCache();
+
+	/// false if disabled or the cache directory could not be created
+	bool enabled() const { return !dir.empty(); }
+
+	/// fingerprint of input files: name, size, modification time and content
+	/** Pass all files the input consists of, e.g. header and data of an
+		ENVI image. **/
+	static std::string inputFingerprint(const std::vector<std::string> &files);
+
+	/// fingerprint of image content: band data, value range and meta data
+	static std::string imageFingerprint(const multi_img_base &img);
+
+	/// cache key for input fingerprint and processing parameters
+	static Key key(const std::string &input, const std::string &params);
+
+	/// file name of an entry with extension ext, empty if disabled
+	std::string path(const Key &key, const std::string &ext) const;
+
+	/// file name to write an entry to before commit()
+	std::string tempPath(const Key &key, const std::string &ext) const;
+
+	/// publish an entry written to tempPath(), then enforce the size limit
+	bool commit(const Key &key, const std::string &ext) const;
+
+	/// true if entry exists and was derived from the same description
+	/** Marks the entry as recently used. **/
+	bool contains(const Key &key, const std::string &ext) const;
+
+	/// read cached image into empty img, returns false on miss
+	bool load(const Key &key, multi_img &img) const;
+
+	/// store image as native cube file
+	bool store(const Key &key, const multi_img &img) const;
+
+private:
+	/// remove least recently used entries until the cache fits into limit
+	void evict() const;
+
+	std::string dir;
+	unsigned long long limit;
+};
+
+#endif // DERIVED_CACHE_H
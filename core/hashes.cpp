@@ -20,6 +20,14 @@ unsigned long Hashes::djb2(const char *str)
 	return hash;
 }
 
+unsigned long long Hashes::djb2(const void *data, size_t length,
+                                unsigned long long hash)
+{
+	const unsigned char *c = (const unsigned char*)data;
+	for (size_t i = 0; i < length; ++i)
+		hash = ((hash << 5) + hash) + c[i]; /* hash * 33 + c */
+	return hash;
+}
 
 unsigned long Hashes::sdbm(const char *str)
 {
@@ -12,6 +12,8 @@
  * the "well known" functions such as PJW, K&R[1], etc. Also see tpop pp. 126
  * for graphing hash functions. 
  */
+#include <cstddef>
+
 class Hashes {
 
 public:
@@ -33,6 +35,13 @@ public:
 	 */
 	static unsigned long djb2(const char *str);
 
+	/** djb2 over a buffer of length bytes, which may contain zeros. Pass the
+	 * result of a previous call as hash to continue over several buffers.
+	 * Uses 64 bit state also where unsigned long has only 32 bits.
+	 */
+	static unsigned long long djb2(const void *data, size_t length,
+	                               unsigned long long hash = 5381);
+
 	/** this algorithm was created for sdbm (a public-domain reimplementation
 	 * of ndbm) database library. it was found to do well in scrambling bits,
 	 * causing better distribution of the keys and fewer splits. it also
@@ -7,14 +7,22 @@
 */
 
 #include "multi_img.h"
+#include "multi_img_simd.h"
+#include "multi_img_tbb.h"
 #ifdef WITH_OPENCV2 // theoretically, vole could be built w/o opencv..
 #include <iostream>
+#include <stdexcept>
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <cmath>
 
 const float multi_img_base::ValueMin = -FLT_MAX;
 const float multi_img_base::ValueMax = FLT_MAX;
+const int multi_img::CACHE_TILE;
 
 multi_img::multi_img(const std::string& filename)
  : multi_img_base()
@@ -68,15 +76,10 @@ multi_img & multi_img::operator=(const multi_img &a) {
 		meta = a.meta;
 		roi = a.roi;
 
-		// image data
-		bands.resize(a.bands.size());
-		for (size_t i = 0; i < bands.size(); ++i)
-			bands[i] = a.bands[i].clone();
+		// image data, shared until written (copy-on-write)
+		bands = a.bands;
 
-		// cache data
-		pixels = a.pixels;
-		dirty = a.dirty.clone();
-		anydirt = a.anydirt;
+		shareCache(a);
 	}
 	return *this;
 }
@@ -85,16 +88,30 @@ multi_img::multi_img(const multi_img &a, bool omitCache)
  : multi_img_base(a), roi(a.roi), bands(a.size())
 {
 	std::cerr << "multi_img: copy" << std::endl;
+	// image data, shared until written (copy-on-write)
 	for (size_t i = 0; i < bands.size(); ++i)
-		bands[i] = a.bands[i].clone();
+		bands[i] = a.bands[i];
 
-	if (omitCache) {
+	if (omitCache)
 		resetPixels();
-	} else {
-		pixels = a.pixels;
-		dirty = a.dirty.clone();
-		anydirt = a.anydirt;
+	else
+		shareCache(a);
+}
+
+void multi_img::shareCache(const multi_img &a)
+{
+	/* only a complete cache is shared, so neither image has a dirty tile in
+	   it to rebuild lazily. writes detach the cache first. */
+	if (a.anydirt || a.pixels.empty()) {
+		resetPixels();
+		return;
 	}
+	pixels = a.pixels;
+	dirty = a.dirty.clone();
+	anydirt = false;
+	quantized = a.quantized;
+	quantizedRange = a.quantizedRange;
+	quantizedDataRange = a.quantizedDataRange;
 }
 
 multi_img::multi_img(const multi_img_base &a, const cv::Rect &roi)
@@ -102,14 +119,25 @@ multi_img::multi_img(const multi_img_base &a, const cv::Rect &roi)
 {
 	width = roi.width;
 	height = roi.height;
-	for (size_t i = 0; i < bands.size(); ++i) {
-		Band band;
-		a.getBand(i, band);
-		a.scopeBand(band, roi, bands[i]);
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, bands.size(), 1),
+		[&](const tbb::blocked_range<size_t> &r) {
+			for (size_t i = r.begin(); i != r.end(); ++i)
+				a.getBandRegion(i, roi, bands[i]);
+		});
+	/* band data is referenced, and detached on write (copy-on-write) */
+
+	/* a valid parent cache is referenced as well. the row pointers of the
+	   sub-matrix carry the parent's stride, so cachePtr() works unchanged */
+	const multi_img *parent = dynamic_cast<const multi_img*>(&a);
+	if (parent && !empty() && parent->pixelsValid(roi)) {
+		const int D = (int)size();
+		pixels = parent->pixels(cv::Rect(roi.x * D, roi.y, roi.width * D,
+		                                 roi.height));
+		dirty = cv::Mat1b((height + CACHE_TILE - 1) / CACHE_TILE,
+		                  (width + CACHE_TILE - 1) / CACHE_TILE, (uchar)0);
+		anydirt = false;
+		return;
 	}
-	/* FIXME: - inconsistent to other copy constr.
-	          - will lead to corrupt cache data!
-                use vector of pointers for cache and copy them, too? */
 	resetPixels();
 }
 
@@ -124,67 +152,246 @@ multi_img::multi_img(const multi_img &a, unsigned int start, unsigned int end) :
 	std::cerr << "multi_img: reference w/ spectral crop" << std::endl;
 	meta.insert(meta.begin(), a.meta.begin() + start, a.meta.begin() + (end+1));
 	bands.insert(bands.begin(), a.bands.begin() + start, a.bands.begin() + (end+1));
-	/* FIXME: - inconsistent to other copy constr.
-	          - will lead to corrupt cache data!
-			  read-only flag? no constructor but const method?
-	*/
+	/* band data is referenced, and detached on write (copy-on-write) */
 	resetPixels();
 }
 
 void multi_img::resetPixels(bool force) const
 {
-	if (force || pixels.empty()) {
-		pixels.assign(width * height, Pixel(size()));
-	}
-	if (force || dirty.empty())
-		dirty = cv::Mat1b(height, width, 255);
+	invalidateDerived();
+	// a cache shared with a copy stays with the copy
+	if (force || isShared(pixels))
+		pixels.release();
+	// one contiguous buffer for all pixels, no-op if geometry is unchanged
+	pixels.create(height, width * (int)bands.size());
+	int tilesY = (height + CACHE_TILE - 1) / CACHE_TILE;
+	int tilesX = (width + CACHE_TILE - 1) / CACHE_TILE;
+	if (force || isShared(dirty) || dirty.rows != tilesY || dirty.cols != tilesX)
+		dirty = cv::Mat1b(tilesY, tilesX, 255);
 	else
 		dirty.setTo(255);
 	anydirt = true;
 }
 
-void multi_img::rebuildPixels(bool optimistic) const
+bool multi_img::isShared(const cv::Mat &m)
 {
-	if (!anydirt || (optimistic && countNonZero(dirty) == 0))
-		return;
+	if (!m.data)
+		return false;
+	// without reference counter, the data is owned by someone else
+#if CV_MAJOR_VERSION < 3
+	return !m.refcount || *m.refcount > 1;
+#else
+	return !m.u || m.u->refcount > 1;
+#endif
+}
 
-	std::cerr << "multi_img: complete rebuild" << std::endl;
-	Band::const_iterator it;
-	register unsigned int d, i;
-	for (d = 0; d < size(); ++d) {
-		const Band &src = bands[d];
-		for (it = src.begin(), i = 0; it != src.end(); ++it, ++i)
-			pixels[i][d] = *it;
-	}
-	dirty.setTo(0);
-	anydirt = false;
+void multi_img::detachBand(size_t band)
+{
+	// called before every write
+	invalidateDerived();
+	Band &b = bands[band];
+	if (isShared(b))
+		b = b.clone();
 }
 
-void multi_img::rebuildPixel(unsigned int row, unsigned int col) const
+void multi_img::detachBands()
 {
-	std::cerr << "multi_img: rebuild pixel " << row << "." << col << std::endl;
-	Pixel &p = pixels[row*width + col];
-	for (size_t i = 0; i < size(); ++i)
-		p[i] = bands[i](row, col);
+	for (size_t d = 0; d < bands.size(); ++d)
+		detachBand(d);
+}
+
+void multi_img::detachPixels() const
+{
+	invalidateDerived();
+	if (isShared(pixels))
+		pixels = pixels.clone();
+	if (isShared(dirty))
+		dirty = dirty.clone();
+}
 
-	dirty(row, col) = 0;
+void multi_img::validatePixels() const
+{
+	dirty.setTo(0);
+	anydirt = false;
 }
 
-std::vector<const multi_img::Pixel*> multi_img::getSegment(const cv::Mat1b &mask)
+void multi_img::markDirty(const cv::Mat1b &mask) const
 {
 	assert(mask.rows == height && mask.cols == width);
-
-	std::vector<const Pixel*> ret;
 	for (int row = 0; row < height; ++row) {
 		const uchar *m = mask[row];
+		uchar *drow = dirty[row / CACHE_TILE];
 		for (int col = 0; col < width; ++col) {
 			if (m[col] > 0) {
-				if (anydirt && dirty(row, col))
-					rebuildPixel(row, col);
-				ret.push_back(&pixels[row*width + col]);
+				drow[col / CACHE_TILE] = 255;
+				anydirt = true;
+				// skip to the next tile, it is dirty anyways
+				col = (col / CACHE_TILE + 1) * CACHE_TILE - 1;
 			}
 		}
 	}
+}
+
+void multi_img::fillTile(int tileRow, int tileCol) const
+{
+	const int y0 = tileRow * CACHE_TILE, y1 = std::min(y0 + CACHE_TILE, height);
+	const int x0 = tileCol * CACHE_TILE, x1 = std::min(x0 + CACHE_TILE, width);
+	const size_t D = bands.size();
+	/* transpose band data into the interleaved cache. the written part of
+	   each cache row is small enough to stay in the CPU cache while we walk
+	   over all bands */
+	for (int row = y0; row < y1; ++row) {
+		Value *dst = pixels[row];
+		for (size_t d = 0; d < D; ++d) {
+			const Value *src = bands[d][row];
+			for (int col = x0; col < x1; ++col)
+				dst[col*D + d] = src[col];
+		}
+	}
+}
+
+void multi_img::rebuildPixels(bool optimistic) const
+{
+	if (!anydirt)
+		return;
+
+	// collect dirty tiles
+	std::vector<cv::Point> todo;
+	for (int ty = 0; ty < dirty.rows; ++ty) {
+		const uchar *drow = dirty[ty];
+		for (int tx = 0; tx < dirty.cols; ++tx) {
+			if (drow[tx] || !optimistic)
+				todo.push_back(cv::Point(tx, ty));
+		}
+	}
+
+	rebuildTiles(todo);
+	validatePixels();
+}
+
+void multi_img::rebuildPixels(const cv::Rect &area) const
+{
+	if (!anydirt)
+		return;
+
+	// only tiles inside the image
+	const cv::Rect a = area & cv::Rect(0, 0, width, height);
+	if (a.area() <= 0)
+		return;
+
+	// collect dirty tiles in area
+	const int ty0 = a.y / CACHE_TILE;
+	const int ty1 = (a.y + a.height - 1) / CACHE_TILE;
+	const int tx0 = a.x / CACHE_TILE;
+	const int tx1 = (a.x + a.width - 1) / CACHE_TILE;
+	std::vector<cv::Point> todo;
+	for (int ty = ty0; ty <= ty1; ++ty) {
+		const uchar *drow = dirty[ty];
+		for (int tx = tx0; tx <= tx1; ++tx) {
+			if (drow[tx])
+				todo.push_back(cv::Point(tx, ty));
+		}
+	}
+	rebuildTiles(todo);
+}
+
+void multi_img::rebuildSegment(const cv::Mat1b &mask) const
+{
+	if (!anydirt)
+		return;
+
+	// collect dirty tiles that contain a pixel in mask
+	std::vector<cv::Point> todo;
+	for (int ty = 0; ty < dirty.rows; ++ty) {
+		const uchar *drow = dirty[ty];
+		for (int tx = 0; tx < dirty.cols; ++tx) {
+			if (!drow[tx])
+				continue;
+			cv::Rect tile(tx * CACHE_TILE, ty * CACHE_TILE,
+			              CACHE_TILE, CACHE_TILE);
+			tile &= cv::Rect(0, 0, width, height);
+			if (cv::countNonZero(mask(tile)) > 0)
+				todo.push_back(cv::Point(tx, ty));
+		}
+	}
+	rebuildTiles(todo);
+}
+
+void multi_img::rebuildTiles(const std::vector<cv::Point> &todo) const
+{
+	if (todo.empty())
+		return;
+
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, todo.size()),
+					  [&](const tbb::blocked_range<size_t> &r) {
+		for (size_t i = r.begin(); i != r.end(); ++i)
+			fillTile(todo[i].y, todo[i].x);
+	});
+	for (size_t i = 0; i < todo.size(); ++i)
+		dirty(todo[i].y, todo[i].x) = 0;
+	stats.tilesRebuilt += todo.size();
+	stats.bulkRebuilds++;
+}
+
+bool multi_img::pixelsValid(const cv::Rect &area) const
+{
+	if (pixels.empty())
+		return false;
+	if (!anydirt)
+		return true;
+
+	const int ty1 = (area.y + area.height - 1) / CACHE_TILE;
+	const int tx1 = (area.x + area.width - 1) / CACHE_TILE;
+	for (int ty = area.y / CACHE_TILE; ty <= ty1; ++ty) {
+		const uchar *drow = dirty[ty];
+		for (int tx = area.x / CACHE_TILE; tx <= tx1; ++tx) {
+			if (drow[tx])
+				return false;
+		}
+	}
+	return true;
+}
+
+void multi_img::rebuildTile(int tileRow, int tileCol) const
+{
+	fillTile(tileRow, tileCol);
+	dirty(tileRow, tileCol) = 0;
+	stats.tilesRebuilt++;
+}
+
+std::vector<size_t> multi_img::segmentOffsets(const cv::Mat1b &mask)
+{
+	// count per row in parallel, then prefix sum over rows
+	std::vector<size_t> offsets(mask.rows + 1, 0);
+	tbb::parallel_for(tbb::blocked_range<int>(0, mask.rows),
+		[&](const tbb::blocked_range<int> &r) {
+			for (int row = r.begin(); row != r.end(); ++row)
+				offsets[row + 1] = cv::countNonZero(mask.row(row));
+		});
+	for (int row = 0; row < mask.rows; ++row)
+		offsets[row + 1] += offsets[row];
+	return offsets;
+}
+
+std::vector<multi_img::PixelView> multi_img::getSegment(const cv::Mat1b &mask)
+{
+	assert(mask.rows == height && mask.cols == width);
+
+	rebuildSegment(mask);
+	const std::vector<size_t> offsets = segmentOffsets(mask);
+	const size_t D = bands.size();
+	std::vector<PixelView> ret(offsets.back());
+	tbb::parallel_for(tbb::blocked_range<int>(0, height),
+		[&](const tbb::blocked_range<int> &r) {
+			for (int row = r.begin(); row != r.end(); ++row) {
+				const uchar *m = mask[row];
+				size_t i = offsets[row];
+				for (int col = 0; col < width; ++col) {
+					if (m[col] > 0)
+						ret[i++] = PixelView(cachePtr(row, col), D);
+				}
+			}
+		});
 	return ret;
 }
 
@@ -192,31 +399,77 @@ std::vector<multi_img::Pixel> multi_img::getSegmentCopy(const cv::Mat1b &mask)
 {
 	assert(mask.rows == height && mask.cols == width);
 
-	std::vector<Pixel> ret;
-	for (int row = 0; row < height; ++row) {
-		const uchar *m = mask[row];
-		for (int col = 0; col < width; ++col) {
-			if (m[col] > 0) {
-				if (anydirt && dirty(row, col))
-					rebuildPixel(row, col);
-				ret.push_back(pixels[row*width + col]);
+	rebuildSegment(mask);
+	const std::vector<size_t> offsets = segmentOffsets(mask);
+	const size_t D = bands.size();
+	std::vector<Pixel> ret(offsets.back());
+	tbb::parallel_for(tbb::blocked_range<int>(0, height),
+		[&](const tbb::blocked_range<int> &r) {
+			for (int row = r.begin(); row != r.end(); ++row) {
+				const uchar *m = mask[row];
+				size_t i = offsets[row];
+				for (int col = 0; col < width; ++col) {
+					if (m[col] > 0) {
+						const Value *p = cachePtr(row, col);
+						ret[i++].assign(p, p + D);
+					}
+				}
 			}
-		}
-	}
+		});
 	return ret;
 }
 
+cv::Mat_<multi_img::Value> multi_img::getSegmentMatrix(const cv::Mat1b &mask) const
+{
+	assert(mask.rows == height && mask.cols == width);
+
+	const std::vector<size_t> offsets = segmentOffsets(mask);
+	const size_t D = bands.size();
+	cv::Mat_<Value> ret((int)offsets.back(), (int)D);
+	/* copy from clean cache tiles, gather from band data otherwise. the
+	   cache is left untouched */
+	tbb::parallel_for(tbb::blocked_range<int>(0, height),
+		[&](const tbb::blocked_range<int> &r) {
+			for (int row = r.begin(); row != r.end(); ++row) {
+				const uchar *m = mask[row];
+				const uchar *drow = dirty[row / CACHE_TILE];
+				int i = (int)offsets[row];
+				for (int col = 0; col < width; ++col) {
+					if (m[col] == 0)
+						continue;
+					Value *dst = ret[i++];
+					if (!anydirt || !drow[col / CACHE_TILE]) {
+						const Value *p = cachePtr(row, col);
+						std::copy(p, p + D, dst);
+					} else {
+						for (size_t d = 0; d < D; ++d)
+							dst[d] = bands[d](row, col);
+					}
+				}
+			}
+		});
+	return ret;
+}
+
+void multi_img::prepareWrite()
+{
+	detachBands();
+	detachPixels();
+}
+
 void multi_img::setPixel(unsigned int row, unsigned int col,
 						 const Pixel &values)
 {
 	assert((int)row < height && (int)col < width);
 	assert(values.size() == size());
-	Pixel &p = pixels[row*width + col];
-	p = values;
+	assert(!isShared(pixels));
+	invalidateDerived();
 	for (size_t i = 0; i < size(); ++i)
-		bands[i](row, col) = p[i];
+		bands[i](row, col) = values[i];
 
-	dirty(row, col) = 0;
+	// a dirty tile will pick up the new values when it is rebuilt
+	if (!dirty(row / CACHE_TILE, col / CACHE_TILE))
+		std::copy(values.begin(), values.end(), cachePtr(row, col));
 }
 
 // matrix version
@@ -225,13 +478,15 @@ void multi_img::setPixel(unsigned int row, unsigned int col,
 {
 	assert((int)row < height && (int)col < width);
 	assert(values.rows*values.cols == (int)size());
-	Pixel &p = pixels[row*width + col];
-	p.assign(values.begin(), values.end());
-
-	for (size_t i = 0; i < size(); ++i)
-		bands[i](row, col) = p[i];
+	assert(!isShared(pixels));
+	invalidateDerived();
+	cv::MatConstIterator_<Value> it = values.begin();
+	for (size_t i = 0; i < size(); ++i, ++it)
+		bands[i](row, col) = *it;
 
-	dirty(row, col) = 0;
+	// a dirty tile will pick up the new values when it is rebuilt
+	if (!dirty(row / CACHE_TILE, col / CACHE_TILE))
+		std::copy(values.begin(), values.end(), cachePtr(row, col));
 }
 
 void multi_img::setBand(unsigned int band, const Band &data,
@@ -239,25 +494,29 @@ void multi_img::setBand(unsigned int band, const Band &data,
 {
 	assert(band < size());
 	assert(data.rows == height && data.cols == width);
+	detachBand(band);
+	detachPixels();
 	Band &b = bands[band];
-	Band::const_iterator bit = b.begin();
-	cv::Mat1b::const_iterator dit = dirty.begin();
-	/* we use opencv to copy the band data. afterwards, we update the pixels
-	   cache. we do this only for pixels, which are not dirty yet (and would
-	   need a complete rebuild anyways. As we instantly fix the other pixels,
-	   those do not get marked as dirty by us. */
+	/* we use opencv to copy the band data. for a masked update, all tiles
+	   touched by the mask are marked dirty and rebuilt in bulk on next access.
+	   otherwise we update the band in all clean tiles of the cache right away
+	   (dirty ones would need a complete rebuild anyways). */
 	if (!mask.empty()) {
 		assert(mask.rows == height && mask.cols == width);
-		cv::Mat1b::const_iterator mit = mask.begin();
 		data.copyTo(b, mask);
-		for (int i = 0; bit != b.end(); ++bit, ++dit, ++mit, ++i)
-			if ((*mit > 0)&&(*dit == 0))
-				pixels[i][band] = *bit;
-	} else {
-		data.copyTo(b);
-		for (int i = 0; bit != b.end(); ++bit, ++dit, ++i) {
-			if ((*dit == 0))
-				pixels[i][band] = *bit;
+		markDirty(mask);
+		return;
+	}
+
+	data.copyTo(b);
+	const size_t D = bands.size();
+	for (int row = 0; row < height; ++row) {
+		const Value *src = b[row];
+		const uchar *drow = dirty[row / CACHE_TILE];
+		Value *dst = pixels[row] + band;
+		for (int col = 0; col < width; ++col) {
+			if (drow[col / CACHE_TILE] == 0)
+				dst[col*D] = src[col];
 		}
 	}
 }
@@ -265,53 +524,128 @@ void multi_img::setBand(unsigned int band, const Band &data,
 void multi_img::setSegment(const std::vector<Pixel> &values, const cv::Mat1b &mask)
 {
 	assert(mask.rows == height && mask.cols == width);
-	int i = 0;
-	for (int row = 0; row < height; ++row) {
-		const uchar *m = mask[row];
-		for (int col = 0; col < width; ++col) {
-			if (m[col] > 0) {
-				setPixel(row, col, values.at(i)); // vector does bound checking
-				++i;
-			}
-		}
+	// check all sizes before the parallel pass reads any value
+	const std::vector<size_t> offsets = segmentOffsets(mask);
+	if (values.size() != offsets.back())
+		throw std::out_of_range("multi_img::setSegment(): "
+		                        "number of values does not match mask");
+	for (size_t i = 0; i < values.size(); ++i) {
+		if (values[i].size() != size())
+			throw std::out_of_range("multi_img::setSegment(): "
+			                        "pixel length does not match image");
 	}
+	detachBands();
+	detachPixels();
+	tbb::parallel_for(tbb::blocked_range<int>(0, height),
+		[&](const tbb::blocked_range<int> &r) {
+			for (int row = r.begin(); row != r.end(); ++row) {
+				const uchar *m = mask[row];
+				size_t i = offsets[row];
+				for (int col = 0; col < width; ++col) {
+					if (m[col] > 0) {
+						const Pixel &v = values[i++];
+						for (size_t d = 0; d < v.size(); ++d)
+							bands[d](row, col) = v[d];
+					}
+				}
+			}
+		});
+	// cache gets rebuilt tile-wise
+	markDirty(mask);
 }
 
 void multi_img::setSegment(const std::vector<cv::Mat_<Value> > &values,
 						   const cv::Mat1b &mask)
 {
 	assert(mask.rows == height && mask.cols == width);
-	int i = 0;
-	for (int row = 0; row < height; ++row) {
-		const uchar *m = mask[row];
-		for (int col = 0; col < width; ++col) {
-			if (m[col] > 0) {
-				setPixel(row, col, values[i]);
-				++i;
-			}
-		}
+	// check all sizes before the parallel pass reads any value
+	const std::vector<size_t> offsets = segmentOffsets(mask);
+	if (values.size() != offsets.back())
+		throw std::out_of_range("multi_img::setSegment(): "
+		                        "number of values does not match mask");
+	for (size_t i = 0; i < values.size(); ++i) {
+		if (values[i].total() != size())
+			throw std::out_of_range("multi_img::setSegment(): "
+			                        "pixel length does not match image");
 	}
+	detachBands();
+	detachPixels();
+	tbb::parallel_for(tbb::blocked_range<int>(0, height),
+		[&](const tbb::blocked_range<int> &r) {
+			for (int row = r.begin(); row != r.end(); ++row) {
+				const uchar *m = mask[row];
+				size_t i = offsets[row];
+				for (int col = 0; col < width; ++col) {
+					if (m[col] > 0) {
+						const cv::Mat_<Value> &v = values[i++];
+						cv::MatConstIterator_<Value> it = v.begin();
+						for (size_t d = 0; d < size(); ++d, ++it)
+							bands[d](row, col) = *it;
+					}
+				}
+			}
+		});
+	// cache gets rebuilt tile-wise
+	markDirty(mask);
+}
+
+void multi_img::setSegment(const cv::Mat_<Value> &values, const cv::Mat1b &mask)
+{
+	assert(mask.rows == height && mask.cols == width);
+	// check all sizes before the parallel pass reads any value
+	const std::vector<size_t> offsets = segmentOffsets(mask);
+	if ((size_t)values.rows != offsets.back() || values.cols != (int)size())
+		throw std::out_of_range("multi_img::setSegment(): "
+		                        "value matrix does not match mask and image");
+	detachBands();
+	detachPixels();
+	const size_t D = bands.size();
+	tbb::parallel_for(tbb::blocked_range<int>(0, height),
+		[&](const tbb::blocked_range<int> &r) {
+			for (int row = r.begin(); row != r.end(); ++row) {
+				const uchar *m = mask[row];
+				int i = (int)offsets[row];
+				for (int col = 0; col < width; ++col) {
+					if (m[col] > 0) {
+						const Value *v = values[i++];
+						for (size_t d = 0; d < D; ++d)
+							bands[d](row, col) = v[d];
+					}
+				}
+			}
+		});
+	// cache gets rebuilt tile-wise
+	markDirty(mask);
 }
 
 void multi_img::setTo(const Pixel &p)
 {
 	assert(p.size() == size());
-	for (size_t i = 0; i < size(); ++i)
+	for (size_t i = 0; i < size(); ++i) {
+		// no need to copy shared data that gets overwritten
+		if (isShared(bands[i]))
+			bands[i] = Band(height, width);
 		bands[i].setTo(p[i]);
+	}
+	// cache became invalid
+	resetPixels();
 }
 
 void multi_img::applyCache()
 {
-	for (unsigned int d = 0; d < size(); ++d) {
-		Band &dst = bands[d];
-		Band::iterator it;
-		unsigned int i;
-		for (it = dst.begin(), i = 0; it != dst.end(); it++, i++)
-			*it = pixels[i][d];
+	detachBands();
+	detachPixels();
+	const size_t D = bands.size();
+	for (int row = 0; row < height; ++row) {
+		const Value *src = pixels[row];
+		for (size_t d = 0; d < D; ++d) {
+			Value *dst = bands[d][row];
+			for (int col = 0; col < width; ++col)
+				dst[col] = src[col*D + d];
+		}
 	}
 	// cache data is now consistent with band data
-	dirty.setTo(0);
-	anydirt = false;
+	validatePixels();
 }
 
 multi_img::Range multi_img::data_range(double fraction) const
@@ -319,77 +653,142 @@ multi_img::Range multi_img::data_range(double fraction) const
 	assert(!empty());
 	assert(fraction < .5);
 
-	/*  find overall data range */
-	Range ret(bands[0](0,0), bands[0](0,0));
-	double tmp1, tmp2;
-	for (unsigned int d = 0; d < size(); ++d) {
-		cv::minMaxLoc(bands[d], &tmp1, &tmp2);
-		ret.min = std::min<Value>(ret.min, (Value)tmp1);
-		ret.max = std::max<Value>(ret.max, (Value)tmp2);
+	if (fraction == 0.) {
+		/*  find overall data range */
+		DetermineRange determineRange(const_cast<multi_img&>(*this));
+		tbb::parallel_reduce(tbb::blocked_range<size_t>(0, size()),
+		                     determineRange);
+		return Range(determineRange.GetMin(), determineRange.GetMax());
 	}
 
-	if (fraction == 0.) {
-		return ret;
+	/* we build histograms to find "good" data range */
+	return band_statistics().robust(fraction);
+}
+
+multi_img::BandStatistics multi_img::band_statistics() const
+{
+	assert(!empty());
+
+	DetermineStatistics determineStatistics(const_cast<multi_img&>(*this));
+	tbb::parallel_reduce(tbb::blocked_range2d<int>(0, (int)size(),
+	                                               0, height),
+	                     determineStatistics);
+	return determineStatistics.result();
+}
+
+const int multi_img::BandStatistics::BINS;
+
+multi_img::Range multi_img::BandStatistics::total() const
+{
+	Range ret(ValueMax, ValueMin);
+	for (size_t d = 0; d < range.size(); ++d) {
+		ret.min = std::min(ret.min, range[d].min);
+		ret.max = std::max(ret.max, range[d].max);
 	}
+	return ret;
+}
 
-	/* we build a histogram to find "good" data range */
-	cv::Mat_<float> hist;
-	// todo: argument of the function?
-	int bins = 100;
-	int histSize[] = { bins };
-	float range1[] = { ret.min, ret.max };
-	const float *ranges[] = { range1 };
-	int channels[] = { 0 };
+multi_img::Range multi_img::BandStatistics::robust(double fraction) const
+{
+	Range ret = total();
+	if (fraction <= 0.)
+		return ret;
 
-	for (unsigned int d = 0; d < size(); ++d)
-		cv::calcHist(&bands[d], 1, channels, cv::Mat(), hist,
-					 1, histSize, ranges, true, d>0);
+	// joint histogram of all bands
+	cv::Mat_<int> joint;
+	cv::reduce(hist, joint, 0, CV_REDUCE_SUM, CV_32S);
+	const int *h = joint[0];
 
 	/* we defensively choose bin borders as new range approx. */
-	double binsize = (ret.max - ret.min)/(double)bins;
-	int needed = (int)std::ceil((double)(width*height*size())*fraction);
-	int found, index;
+	double binsize = ((double)histRange.max - histRange.min) / BINS;
+	size_t needed = (size_t)std::ceil((double)(count*range.size())*fraction);
+	size_t found;
+	int index;
 
 	/* first: small values */
 	found = 0;
 	index = 0;
-	while (found < needed) {
-		found += (int)hist[index][0];
-		index++;
-	}
-	// set to lower boundary of last outlier bin
-	ret.min = ret.min + (Value)(binsize*(index - 1));
+	while (found < needed && index < BINS + 2)
+		found += h[index++];
+	// set to lower boundary of last outlier bin (underflow: observed min)
+	if (index > 1)
+		ret.min = std::max(ret.min,
+		                   (Value)(histRange.min + binsize*(index - 2)));
 
 	/* second: large values */
 	found = 0;
-	index = hist.rows - 1;
-	while (found < needed) {
-		found += (int)hist[index][0];
-		index--;
-	}
-	// set to upper boundary of last outlier bin
-	ret.max = ret.max - (Value)(binsize*(hist.rows - index - 2));
+	index = BINS + 1;
+	while (found < needed && index >= 0)
+		found += h[index--];
+	// set to upper boundary of last outlier bin (overflow: observed max)
+	if (index < BINS)
+		ret.max = std::min(ret.max,
+		                   (Value)(histRange.min + binsize*(index + 1)));
 
 	return ret;
 }
 
-cv::PCA multi_img::pca(unsigned int components) const
+int multi_img::pca_sample_step(size_t maxSamples) const
+{
+	const size_t N = (size_t)width * height;
+	if (maxSamples == 0 || N <= maxSamples)
+		return 1;
+	return (int)std::ceil(std::sqrt((double)N / maxSamples));
+}
+
+cv::PCA multi_img::pca(unsigned int components, size_t maxSamples,
+                       bool randomized) const
 {
 	assert(components <= size());
 
-	// make sure cache is there
-	rebuildPixels(true);
+	// accumulate statistics directly from band data, no copy needed
+	int step = pca_sample_step(maxSamples);
+	Covariance cov(const_cast<multi_img&>(*this), step);
+	tbb::parallel_reduce(tbb::blocked_range<int>(0,
+	                         Covariance::sampledRows(*this, step)), cov);
+
+	return pca_solve(cov.sum, cov.scatter, cov.count, components, randomized);
+}
+
+cv::PCA multi_img::pca_solve(const cv::Mat_<double> &sum,
+                             const cv::Mat_<double> &scatter, size_t count,
+                             unsigned int components, bool randomized)
+{
+	const int D = scatter.rows;
+	const int K = (components == 0 ? D : std::min((int)components, D));
+
+	// covariance matrix, scaled like cv::PCA does
+	cv::Mat_<double> mean = sum / (double)count;
+	cv::Mat_<double> covar = scatter / (double)count - mean.t() * mean;
+
+	cv::Mat_<double> eigenvalues, eigenvectors;
+	// oversampling of the randomized range finder
+	const int L = K + 10;
+	if (!randomized || L >= D) {
+		cv::eigen(covar, eigenvalues, eigenvectors);
+	} else {
+		// random projection, fixed seed for reproducible results
+		cv::RNG rng(0x5eed);
+		cv::Mat_<double> omega(D, L), y, q, w, vt;
+		rng.fill(omega, cv::RNG::NORMAL, 0., 1.);
+		y = covar * omega;
+		// power iterations sharpen the spectrum, re-orthonormalize each time
+		for (int i = 0; i < 2; ++i) {
+			cv::SVD::compute(y, w, q, vt);
+			y = covar * q;
+		}
+		cv::SVD::compute(y, w, q, vt);
 
-	// create input matrix
-	cv::Mat_<Value> input(size(), (int)pixels.size());
-	for (size_t i = 0; i < pixels.size(); ++i) {
-		cv::Mat_<Value> in(pixels[i]);
-		cv::Mat_<Value> out(input.col((int)i));
-		in.copyTo(out);
+		// solve small problem in the subspace and map back
+		cv::Mat_<double> small = q.t() * covar * q, v;
+		cv::eigen(small, eigenvalues, v);
+		eigenvectors = v * q.t();
 	}
 
-	// perform PCA
-	cv::PCA ret(input, cv::noArray(), CV_PCA_DATA_AS_COL, (int)components);
+	cv::PCA ret;
+	mean.reshape(1, D).convertTo(ret.mean, ValueType);
+	eigenvalues.rowRange(0, K).convertTo(ret.eigenvalues, ValueType);
+	eigenvectors.rowRange(0, K).convertTo(ret.eigenvectors, ValueType);
 	return ret;
 }
 
@@ -397,15 +796,9 @@ multi_img multi_img::project(const cv::PCA &pca) const
 {
 	multi_img ret(height, width, pca.eigenvectors.rows);
 
-	// make sure input cache is there
-	rebuildPixels(true);
-
-	// write
-	for (size_t i = 0; i < ret.pixels.size(); ++i) {
-		cv::Mat_<Value> input(pixels[i]);
-		cv::Mat_<Value> output(ret.pixels[i]);
-		pca.project(input, output);
-	}
+	// project band data directly into the cache of ret
+	PcaProjection computeProjection(const_cast<multi_img&>(*this), ret, pca);
+	tbb::parallel_for(tbb::blocked_range<int>(0, height), computeProjection);
 
 	// write back to band data
 	ret.applyCache();
@@ -442,6 +835,7 @@ multi_img::Pixel multi_img::backProject(const Pixel &p, const cv::PCA &pca)
 
 void multi_img::clamp()
 {
+	detachBands();
 	for (unsigned int d = 0; d < size(); ++d) {
 		Band &b = bands[d];
 		cv::max(b, minval, b);
@@ -457,6 +851,7 @@ void multi_img::data_rescale(Value newminval, Value newmaxval)
 		return;
 
 	Value scale = (newmaxval - newminval)/(maxval - minval);
+	detachBands();
 	for (size_t d = 0; d < size(); ++d) {
 		Band &b = bands[d];
 		if (newminval == 0. && minval == 0.) {
@@ -487,16 +882,24 @@ void multi_img::data_stretch()
 	data_rescale(newmin, newmax);
 }
 
-void multi_img::data_stretch_single(Value newmin, Value newmax)
+void multi_img::data_stretch_single(Value newmin, Value newmax,
+                                    const BandStatistics *stats)
 {
+	// per-band ranges, computed in one pass if not provided
+	BandStatistics own;
+	if (!stats) {
+		own = band_statistics();
+		stats = &own;
+	}
+
 	if (newmin != newmax) {
 		minval = newmin;
 		maxval = newmax;
 	}
+	detachBands();
 	for (size_t d = 0; d < size(); ++d) {
 		Band &b = bands[d];
-		double mi, ma;
-		cv::minMaxLoc(b, &mi, &ma);
+		double mi = stats->range[d].min, ma = stats->range[d].max;
 		double scale = (maxval - minval)/(ma - mi);
 
 		if (mi == 0. && minval == 0.) {
@@ -513,6 +916,7 @@ void multi_img::data_stretch_single(Value newmin, Value newmax)
 
 void multi_img::flip(int flipCode)
 {
+	detachBands();
 	for (size_t i = 0; i < size(); ++i)
 		cv::flip(bands[i], bands[i], flipCode);
 
@@ -538,19 +942,20 @@ void multi_img::transpose()
 void multi_img::normalize_magnitudes()
 {
 	rebuildPixels(true);
-	std::vector<Pixel>::iterator it;
-	for (it = pixels.begin(); it != pixels.end(); ++it) {
-		cv::Mat_<Value> p(*it);
-		double n = cv::norm(p, cv::NORM_L2);
-		if (n == 0.)
-			n = 1.;
-		p /= n;
+	detachPixels();
+	const int D = (int)size();
+	for (int row = 0; row < height; ++row) {
+		for (int col = 0; col < width; ++col) {
+			Value *p = cachePtr(row, col);
+			multi_img_simd::normalize_l2(p, p, D);
+		}
 	}
 	applyCache();
 }
 
 void multi_img::apply_logarithm()
 {
+	detachBands();
 	for (size_t i = 0; i < size(); ++i) {
 		// will assign large negative value to 0 pixels
 		cv::log(bands[i], bands[i]);
@@ -568,6 +973,7 @@ void multi_img::apply_logarithm()
 void multi_img::blur(cv::Size ksize, double sigmaX, double sigmaY,
 					 int borderType)
 {
+	detachBands();
 	for (size_t i = 0; i < size(); ++i) {
 		cv::GaussianBlur(bands[i], bands[i], ksize, sigmaX, sigmaY, borderType);
 	}
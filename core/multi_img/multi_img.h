@@ -21,6 +21,7 @@
 #include <sstream>
 #include <iostream>
 #include <opencv2/imgproc/imgproc.hpp>
+#include <tbb/atomic.h>
 #ifdef WITH_BOOST
 	#include <boost/shared_ptr.hpp>
 #endif
@@ -29,15 +30,18 @@
 #endif
 
 class Illuminant;
+class multi_img_mapped;
+namespace som { class GenSOM; }
 
 // FIXME what a mess
-class Grad;
-class Log;
+class LogGrad;
 class NormL2;
 class Clamp;
 class Illumination;
 class PcaProjection;
-class MultiImg2BandMat;
+class Covariance;
+class DetermineStatistics;
+class multi_img_memory_sink;
 class GradientCuda;
 class GradientTbb;
 class NormL2Tbb;
@@ -56,13 +60,15 @@ class PcaTbb;
 	friend class Band2QImageTbb;\
 	friend class RescaleTbb;\
 	friend class Resize; \
-	friend class Grad;\
-	friend class Log;\
+	friend class LogGrad;\
 	friend class NormL2;\
 	friend class Clamp;\
 	friend class Illumination;\
 	friend class PcaProjection;\
-	friend class MultiImg2BandMat;\
+	friend class Covariance;\
+	friend class DetermineStatistics;\
+	friend class multi_img_memory_sink;\
+	friend class som::GenSOM;\
 	friend class GradientCuda;\
 	friend class GradientTbb;\
 	friend class NormL2Tbb;\
@@ -72,7 +78,8 @@ class PcaTbb;
 	friend class IlluminantCuda;\
 	friend class DataRangeTbb;\
 	friend class DataRangeCuda;\
-	friend class PcaTbb;
+	friend class PcaTbb;\
+	friend class LoadTbb;
 
 class multi_img_base {
 public:
@@ -152,6 +159,15 @@ public:
 	/// returns the roi part of the given band
 	virtual void scopeBand(const Band &source, const cv::Rect &roi, Band &target) const = 0;
 
+	/// returns the roi part of one band, as getBand() and scopeBand()
+	/** Backends override this to avoid handling the whole band. **/
+	virtual void getBandRegion(size_t band, const cv::Rect &roi, Band &data) const
+	{
+		Band full;
+		getBand(band, full);
+		scopeBand(full, roi, data);
+	}
+
 	/// minimum and maximum values (by data format, not actually observed data!)
 	Value minval, maxval;
 
@@ -169,6 +185,13 @@ public:
 	/// band meta-data
 	std::vector<BandDesc> meta;
 
+	/// returns all illuminant coefficients relevant for this image
+	std::vector<Value> getIllumCoeff(const Illuminant&) const;
+
+	/// widen [minval, maxval] to cover the observed range of data
+	/** maxval is doubled as needed, as the image readers assume a dynamic
+		range of a power of two (e.g. 12 bit data stored in 16 bit). **/
+	void fitRange(const Range &data);
 
 protected:
 
@@ -208,8 +231,50 @@ public:
 	/** @note Pixel will always be a std::vector. You can count on this. **/
 	typedef std::vector<Value> Pixel;
 
+	/// read-only view on a spectral pixel, e.g. inside the pixel cache
+	/** The view does not own its data. When obtained from the image, it is
+		valid until the pixel cache is reset or the image is destroyed.
+		A view can also wrap a Pixel, and it converts implicitly (by copy)
+		where a Pixel is expected. */
+	class PixelView {
+	public:
+		typedef const Value* const_iterator;
+
+		PixelView() : ptr(0), len(0) {}
+		PixelView(const Value *data, size_t size) : ptr(data), len(size) {}
+		PixelView(const Pixel &p) : ptr(p.empty() ? 0 : &p[0]), len(p.size()) {}
+
+		inline size_t size() const { return len; }
+		inline bool empty() const { return len == 0; }
+		inline const Value* data() const { return ptr; }
+		inline const_iterator begin() const { return ptr; }
+		inline const_iterator end() const { return ptr + len; }
+		inline const Value& operator[](size_t i) const
+		{ assert(i < len); return ptr[i]; }
+
+		/// copy into a Pixel (reuses its storage if large enough)
+		inline void copyTo(Pixel &p) const { p.assign(ptr, ptr + len); }
+		inline operator Pixel() const { return Pixel(ptr, ptr + len); }
+
+	private:
+		const Value *ptr;
+		size_t len;
+	};
+
 //@}
 
+	/// side length of the square pixel cache tiles (unit of dirty tracking)
+	static const int CACHE_TILE = 32;
+
+	/// counters on pixel cache maintenance
+	struct CacheStats {
+		CacheStats() { tilesRebuilt = 0; bulkRebuilds = 0; }
+		/// number of tiles rebuilt, on access or during bulk rebuild
+		tbb::atomic<size_t> tilesRebuilt;
+		/// number of rebuildPixels() calls that found dirty tiles
+		tbb::atomic<size_t> bulkRebuilds;
+	};
+
 	enum NormMode {
 		NORM_OBSERVED = 0,
 		NORM_THEORETICAL = 1,
@@ -231,18 +296,26 @@ public:
 	multi_img(int height, int width, unsigned int size);
 
 	/// copy constructor
-	/** @arg omitCache only copy the image data, but start with empty cache
+	/** Band data is shared with the original until either side writes to
+		it (copy-on-write). So is the pixel cache if it is complete, otherwise
+		the copy starts with an empty cache.
+		@arg omitCache only copy the image data, but start with empty cache
 	*/
 	multi_img(const multi_img &, bool omitCache = false);
 
-	/// reference (!!) a spatial region of interest (with own cache!)
+	/// reference (!!) a spatial region of interest
+	/** With a multi_img as source, this is a view: band data is shared, and
+		so is the pixel cache if it is valid in the region (see
+		rebuildPixels(const cv::Rect&)). Compact copies are only made when
+		the view is written to (copy-on-write). **/
 	multi_img(const multi_img_base &a, const cv::Rect &roi);
 
 	/// reference (!!) a band subrange including both ends (with own cache!)
 	multi_img(const multi_img &a, unsigned int start, unsigned int end);
 
 	/// assignment operator
-	/** @note A copy of the image (including cache) is created **/
+	/** @note A copy of the image (including cache) is created. Data is
+		shared until either side writes to it (copy-on-write). **/
 	multi_img & operator=(const multi_img &);
 
 	/** reads in and processes either
@@ -281,34 +354,44 @@ public:
 	{ assert(band < size()); return bands[band]; }
 
 	/// returns spectral data of a single pixel
-	inline const Pixel& operator()(unsigned int row, unsigned int col) const
+	/** A dirty tile is rebuilt on access, which is not thread-safe. Call
+		rebuildPixels() before accessing pixels from parallel code. **/
+	inline PixelView operator()(unsigned int row, unsigned int col) const
 	{	assert((int)row < height && (int)col < width);
-		if (anydirt && dirty(row, col))
-			rebuildPixel(row, col);
-		return pixels[row*width + col];
+		if (anydirt && dirty(row / CACHE_TILE, col / CACHE_TILE))
+			rebuildTile(row / CACHE_TILE, col / CACHE_TILE);
+		return PixelView(cachePtr(row, col), bands.size());
 	}
 
 	/// returns spectral data of a single pixel
-	inline const Pixel& operator()(cv::Point pt) const
+	inline PixelView operator()(cv::Point pt) const
 	{ return operator ()(pt.y, pt.x); }
 
 	/// returns spectral data of a single pixel (only if *no* pixel is dirty!)
-	inline const Pixel& atIndex(unsigned int idx) const
+	inline PixelView atIndex(unsigned int idx) const
 	{	assert(!anydirt);
-		return pixels[idx];
+		return PixelView(cachePtr(idx / width, idx % width), bands.size());
 	}
 
 	/// returns spectral data of a segment (using mask)
-	std::vector<const Pixel*> getSegment(const cv::Mat1b &mask);
+	std::vector<PixelView> getSegment(const cv::Mat1b &mask);
 	/// returns copied spectral data of a segment (using mask)
 	std::vector<Pixel> getSegmentCopy(const cv::Mat1b &mask);
+	/// returns spectral data of a segment as N x size() matrix
+	/** Rows are ordered by row index first, column index second. The pixel
+		cache is used where valid, but not rebuilt. **/
+	cv::Mat_<Value> getSegmentMatrix(const cv::Mat1b &mask) const;
 
 //@}
 
 /** @name Element access operators for writing **/
 //@{
 
-	/// sets a single pixel
+	/// give band data and pixel cache their own data (copy-on-write)
+	/** Call once before a series of setPixel(), e.g. before a loop. **/
+	void prepareWrite();
+
+	/// sets a single pixel, see prepareWrite()
 	void setPixel(unsigned int row, unsigned int col, const Pixel& values);
 	/// sets a single pixel
 	void setPixel(unsigned int row, unsigned int col,
@@ -329,10 +412,13 @@ public:
 	  @arg values vector of pixel values which must hold the same amount of
 		   members as non-null mask values, ordered by row index first, column
 		   index second
+	  @throw std::out_of_range if values and mask or image do not match
 	 */
 	void setSegment(const std::vector<Pixel> &values, const cv::Mat1b& mask);
 	void setSegment(const std::vector<cv::Mat_<Value> > &values,
 					const cv::Mat1b& mask);
+	/// replaces all pixels in mask with the rows of an N x size() matrix
+	void setSegment(const cv::Mat_<Value> &values, const cv::Mat1b& mask);
 
 	/// initialize image data with a spectral vector
 	void setTo(const Pixel& p);
@@ -349,12 +435,20 @@ public:
 	void resetPixels(bool force = false) const;
 
 	/// rebuild whole pixel cache (don't wait for dirty pixel access)
-	/** if optimistic, it is checked first if the cache is already sane.
+	/** All dirty tiles are rebuilt in one parallel pass.
+		if optimistic, it is checked first if the cache is already sane.
 		set optimistic to false if you know beforehand it is dirty. */
 	void rebuildPixels(bool optimistic = true) const;
 
-	/// rebuild a single pixel (inefficient if many pixels are processed)
-	void rebuildPixel(unsigned int row, unsigned int col) const;
+	/// rebuild the dirty cache tiles that intersect area (in parallel)
+	/** Use before creating views of the area, so they share the cache. **/
+	void rebuildPixels(const cv::Rect &area) const;
+
+	/// rebuild a single cache tile (given in tile coordinates)
+	void rebuildTile(int tileRow, int tileCol) const;
+
+	/// statistics on cache rebuilds (approximate under concurrent access)
+	const CacheStats& cacheStats() const { return stats; }
 
 //@}
 
@@ -374,6 +468,16 @@ public:
 	std::vector<std::vector<unsigned short> >
 	export_ushort(bool useDataRange = false) const;
 
+	/// returns interleaved 16 bit data as (width*height) x size() matrix
+	/** Pixels are stored row-major, one matrix row per pixel. Values are
+		mapped from minval..maxval (or the actual data range) to 0..65535.
+		@param useDataRange see export_ushort()
+		@param cache keep the result on the image, so later calls share it
+			   until the image data changes. Treat the result as read-only.
+	**/
+	cv::Mat_<unsigned short>
+	export_ushort_mat(bool useDataRange = false, bool cache = true) const;
+
 #ifdef WITH_QT
 	/// return QImage of specific band
 	QImage export_qt(unsigned int band) const;
@@ -399,6 +503,11 @@ public:
 	inline static cv::Mat_<Value> toMat(const Pixel& p)
 	{ return cv::Mat_<Value>(p, true); }
 
+	/// copies a pixel view into a OpenCV matrix (same layout as above)
+	inline static cv::Mat_<Value> toMat(const PixelView& p)
+	{ return cv::Mat_<Value>((int)p.size(), 1,
+	                         const_cast<Value*>(p.data())).clone(); }
+
 	/// copies Matrix into a Pixel
 	inline static Pixel toPixel(const cv::Mat_<Value>& m)
 	{ return Pixel(m.begin(), m.end()); }
@@ -411,24 +520,56 @@ public:
 	int read_mat(const cv::Mat &src);
 	/// add data from one cv::Mat with given source range, returns #channels
 	int read_mat(const cv::Mat &src, Value srcmin, Value srcmax);
+	/// convert cv::Mat to image range, write src.channels() bands into dst
+	void convert_mat(const cv::Mat &src, Value srcmin, Value srcmax,
+					 Band *dst) const;
 
 	/// compile image from filelist (files can have several channels)
-	// will not erase previous data
+	/** Only the region roi (empty: whole image) of bands bandlow..bandhigh
+		(bandhigh < 0: up to last band) is read.
+		Will not erase previous data. **/
 	void read_image(const std::vector<std::string> &files,
-					const std::vector<BandDesc> &descs = std::vector<BandDesc>());
-
-	/// fill image with raw data from file stream, used by read_image_lan
-	/** @note Part of Gerbil. **/
-	void fill_bil(std::ifstream &in, unsigned short depth);
+					const std::vector<BandDesc> &descs = std::vector<BandDesc>(),
+					const cv::Rect &roi = cv::Rect(),
+					int bandlow = 0, int bandhigh = -1);
 
 	/// helper for read_image for LAN images, returns true on success
 	/** @note Part of Gerbil. **/
-	bool read_image_lan(const std::string& filename);
+	bool read_image_lan(const std::string& filename,
+						const cv::Rect &roi = cv::Rect(),
+						int bandlow = 0, int bandhigh = -1);
 
-	/// read grayscale, RGB, LAN or filelist image
+	/// helper for read_image for native cube files, returns true on success
+	/** @note Part of Gerbil. **/
+	bool read_image_cube(const std::string& filename,
+						 const cv::Rect &roi = cv::Rect(),
+						 int bandlow = 0, int bandhigh = -1);
+
+	/// read region roi and bands bandlow..bandhigh of a mapped raw image
+	/** Value range and band descriptions are taken from the source.
+		Returns false if the selection is invalid.
+		@note Part of Gerbil. **/
+	bool read_mapped(const multi_img_mapped &source,
+					 const cv::Rect &roi = cv::Rect(),
+					 int bandlow = 0, int bandhigh = -1);
+
+	/// returns true if file starts with the native cube file signature
+	static bool probe_cube(const std::string& filename);
+
+	/// maps a native cube file without reading it, returns NULL on failure
+	/** Caller takes ownership. **/
+	static multi_img_mapped* open_cube(const std::string& filename);
+
+	/// read grayscale, RGB, LAN, native cube or filelist image
 	/** @note Without gerbil, only grayscale and RGB is supported. **/
 	void read_image(const std::string& filename);
 
+	/// read only region roi of bands bandlow..bandhigh of an image file
+	/** An empty roi selects the whole image, bandhigh < 0 all bands up to
+		the last one. The image is left empty on failure. **/
+	void read_image(const std::string& filename, const cv::Rect &roi,
+					int bandlow = 0, int bandhigh = -1);
+
 	/// write the whole image with base name base (may include directories)
 	/** Output is 8 bit or 16 bit grayscale PNG image.
 	    @param normalize If set (default), output is scaled/shifted for better conversion.
@@ -438,6 +579,20 @@ public:
 	**/
 	void write_out(const std::string& base, bool normalize = true, bool in16bit = true) const;
 
+	/// write the whole image losslessly into a native cube file
+	/** The file holds size, value range, band descriptions and raw float
+		band data (BSQ). It can be read back by read_image() via mmap.
+		@return false on failure
+		@note This function is only available in Gerbil.
+	**/
+	bool write_cube(const std::string& filename) const;
+
+	/// write header of a native cube file, returns offset of band data
+	/** Band data follows in BSQ order, see write_cube(). **/
+	static unsigned long long write_cube_header(std::ostream &out,
+		int width, int height, Value minval, Value maxval,
+		const std::vector<BandDesc> &meta);
+
 //@}
 
 /** @name Data statistics **/
@@ -451,11 +606,53 @@ public:
 	**/
 	Range data_range(double fraction = 0.) const;
 
+	/// per-band statistics gathered in a single pass, see band_statistics()
+	struct BandStatistics {
+		/// number of regular histogram bins
+		static const int BINS = 1024;
+
+		/// observed range and mean of each band
+		std::vector<Range> range;
+		std::vector<double> mean;
+		/// one histogram per band (row) over histRange, BINS + 2 entries:
+		/// values below histRange, regular bins, values above histRange
+		cv::Mat_<int> hist;
+		Range histRange;
+		/// number of values in each band
+		size_t count;
+
+		/// observed range over all bands
+		Range total() const;
+		/// range such that at most fraction of all values lies on each side
+		/** Bin borders are chosen defensively, see data_range(). **/
+		Range robust(double fraction) const;
+	};
+
+	/// compute per-band statistics in one parallel pass
+	/** The histograms cover the theoretical range [minval, maxval]. **/
+	BandStatistics band_statistics() const;
+
 	/// compute PCA of the image
 	/**
 	  @param components number of components to compute (if 0, compute #bands)
+	  @param maxSamples if >0, estimate covariance from a regular spatial
+	                    subsample of at most about maxSamples pixels
+	  @param randomized use randomized solver for the top components
 	  **/
-	cv::PCA pca(unsigned int components = 0) const;
+	cv::PCA pca(unsigned int components = 0, size_t maxSamples = 0,
+	            bool randomized = false) const;
+
+	/// sampling step in both directions to use about maxSamples pixels
+	int pca_sample_step(size_t maxSamples) const;
+
+	/// compute PCA from sum and scatter matrix of count D-dim. vectors
+	/** With randomized, the top components are found by a randomized range
+		finder with power iterations on the covariance matrix instead of a
+		full eigen decomposition.
+		@return PCA as from cv::PCA(..., CV_PCA_DATA_AS_COL, components) **/
+	static cv::PCA pca_solve(const cv::Mat_<double> &sum,
+	                         const cv::Mat_<double> &scatter, size_t count,
+	                         unsigned int components, bool randomized);
 
 	/// apply PCA transform to the image
 	multi_img project(const cv::PCA &pca) const;
@@ -503,8 +700,10 @@ public:
 	/**
    @param minval optional data range (default: image's minval/maxval are used)
    @param maxval optional data range (default: image's minval/maxval are used)
+   @param stats optional statistics of the current data (avoids a pass)
 	  **/
-	void data_stretch_single(Value minval = 0., Value maxval = 0.);
+	void data_stretch_single(Value minval = 0., Value maxval = 0.,
+	                         const BandStatistics *stats = 0);
 
 	/// apply natural logarithm on image
 	void apply_logarithm();
@@ -520,8 +719,50 @@ public:
 	/** @note: Apply the logarithm first! **/
 	multi_img spec_gradient() const;
 
+	/// return spectral gradient of the logarithm of the image
+	/** Same result as apply_logarithm() followed by spec_gradient(), but in
+		a single pass without intermediate image. **/
+	multi_img log_gradient() const;
+
 	/// return a copy with fewer bands (linear interpolation)
     multi_img spec_rescale(unsigned int newsize) const;
+
+	/// sparse linear interpolation matrix for spectral resampling
+	/** Target band j interpolates source bands lo[j] and hi[j] with weight
+		w[j] of the latter, as cv::resize() does for a 1D signal. **/
+	struct Resampling {
+		Resampling(size_t from, size_t to);
+		inline void apply(const Value *src, Value *dst) const {
+			for (size_t j = 0; j < w.size(); ++j)
+				dst[j] = src[lo[j]] * (1.f - w[j]) + src[hi[j]] * w[j];
+		}
+		/// interpolate center wavelengths of band descriptions
+		void apply(const std::vector<BandDesc> &src,
+		           std::vector<BandDesc> &dst) const;
+		std::vector<int> lo, hi;
+		std::vector<Value> w;
+	};
+
+	/// preprocessing steps for preprocess(), applied in this order
+	struct Preprocessing {
+		Preprocessing() : normalize(false), gradient(false), bands(0),
+		                  removeIllum(0), addIllum(0) {}
+		/// normalize L2 magnitudes
+		bool normalize;
+		/// logarithm and spectral gradient
+		bool gradient;
+		/// reduce number of bands (if > 0 and fewer than available)
+		int bands;
+		/// remove / add black body illuminant of given Kelvin (if > 0)
+		int removeIllum, addIllum;
+	};
+
+	/// apply preprocessing steps in a single parallel pass
+	/** Equivalent to normalize_magnitudes(), apply_logarithm() and
+		spec_gradient(), spec_rescale() and apply_illuminant() in sequence,
+		but each pixel is read once and the result is written once.
+		@param target receives the result, previous data is discarded **/
+	void preprocess(const Preprocessing &steps, multi_img &target) const;
 //@}
 
 /** @name Helper functions **/
@@ -552,9 +793,6 @@ public:
 //@{
 	/// apply illuminant to the image (or remove)
 	void apply_illuminant(const Illuminant&, bool remove = false);
-
-	/// returns all illuminant coefficients relevant for this image
-	std::vector<Value> getIllumCoeff(const Illuminant&) const;
 //@}
 
 	/// ROI associated with image data
@@ -564,15 +802,78 @@ protected:
 	/// write back pixel cache into band data
 	void applyCache();
 
+	/// clip roi to image of given size, empty roi selects whole image
+	/** returns false (with error message) if nothing remains **/
+	static bool select_roi(const cv::Size &size, cv::Rect &roi);
+
+	/// resolve band range [low, high] of total bands, high < 0: up to last
+	/** returns false (with error message) if the range is inconsistent **/
+	static bool select_bands(int total, int &low, int &high);
+
 	/// simple data structure initialization
 	void init(int height, int width, unsigned int size,
 			  Value minval = MULTI_IMG_MIN_DEFAULT,
 			  Value maxval = MULTI_IMG_MAX_DEFAULT);
 
+	/// declare the whole pixel cache consistent with band data
+	/** Used after the cache was filled or computed in bulk. **/
+	void validatePixels() const;
+
+	/// copy band data of a tile into the pixel cache (no bookkeeping)
+	void fillTile(int tileRow, int tileCol) const;
+
+	/// rebuild the dirty cache tiles that contain a pixel in mask
+	void rebuildSegment(const cv::Mat1b &mask) const;
+
+	/// rebuild given cache tiles in parallel (in tile coordinates)
+	void rebuildTiles(const std::vector<cv::Point> &tiles) const;
+
+	/// position of each mask row's first pixel in the list of mask pixels
+	/** Has mask.rows + 1 entries, the last one is the number of pixels. **/
+	static std::vector<size_t> segmentOffsets(const cv::Mat1b &mask);
+
+	/// true if the pixel cache is valid in the whole area
+	bool pixelsValid(const cv::Rect &area) const;
+
+	/// mark all tiles dirty that contain a pixel in mask
+	void markDirty(const cv::Mat1b &mask) const;
+
+	/// true if data of m may be referenced by another matrix header
+	static bool isShared(const cv::Mat &m);
+
+	/// give band its own data before writing to it (copy-on-write)
+	void detachBand(size_t band);
+
+	/// give all bands their own data before writing to them
+	void detachBands();
+
+	/// give pixel cache its own data before writing to it
+	void detachPixels() const;
+
+	/// share the pixel cache of a if it is complete, otherwise reset it
+	/** Dirty flags are never shared. **/
+	void shareCache(const multi_img &a);
+
+	/// drop derived data that does not follow changes of the image data
+	void invalidateDerived() const { quantized.release(); }
+
+	/// pointer to the cached spectrum of a pixel (no dirty check!)
+	inline Value* cachePtr(int row, int col) const
+	{ return pixels[row] + col * bands.size(); }
+
 	std::vector<Band> bands;
-	mutable std::vector<Pixel> pixels;
+	/** pixel cache in interleaved (BIP) layout: one row per image row,
+		holding width * size() values. Pixel (row, col) starts at
+		pixels[row] + col * size(). */
+	mutable cv::Mat_<Value> pixels;
+	/// dirty flags, one per cache tile of CACHE_TILE x CACHE_TILE pixels
 	mutable cv::Mat1b dirty;
 	mutable bool anydirt;
+	mutable CacheStats stats;
+	/// cached result of export_ushort_mat() and the range it was made with
+	mutable cv::Mat_<unsigned short> quantized;
+	mutable Range quantizedRange;
+	mutable bool quantizedDataRange;
 
 	MULTI_IMG_FRIENDS
 };
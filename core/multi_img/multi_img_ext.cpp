@@ -9,11 +9,19 @@
 #include <multi_img.h>
 #include "illuminant.h"
 #include "cieobserver.h"
+#include "multi_img_simd.h"
+#include "multi_img_tbb.h"
 
 #include <mmintrin.h>
 #include <xmmintrin.h>
 #include <emmintrin.h>
 
+#include <tbb/blocked_range.h>
+#include <tbb/blocked_range2d.h>
+#include <tbb/parallel_for.h>
+#include <algorithm>
+#include <cmath>
+
 multi_img multi_img::spec_gradient() const
 {
 	multi_img ret(size() - 1);
@@ -32,6 +40,26 @@ multi_img multi_img::spec_gradient() const
 	return ret;
 }
 
+multi_img multi_img::log_gradient() const
+{
+	assert(size() > 1);
+	multi_img ret(height, width, size() - 1);
+	// data format of output, see apply_logarithm()
+	ret.maxval = std::log(maxval);
+	ret.minval = -ret.maxval;
+	for (size_t i = 0; i < ret.size(); ++i) {
+		if (!meta[i].empty && !meta[i+1].empty)
+			ret.meta[i] = BandDesc(meta[i].center, meta[i+1].center);
+	}
+
+	LogGrad computeGradient(const_cast<multi_img&>(*this), ret);
+	tbb::parallel_for(tbb::blocked_range2d<int>(0, height, 16,
+	                                            0, width, LogGrad::TILE),
+	                  computeGradient);
+	// cache was invalidated by constructor
+	return ret;
+}
+
 multi_img multi_img::spec_rescale(unsigned int newsize) const
 {
 	std::cerr << "multi_img: spec_rescale(" << newsize << ")" << std::endl;
@@ -44,34 +72,160 @@ multi_img multi_img::spec_rescale(unsigned int newsize) const
 	ret.minval = minval;
 	ret.maxval = maxval;
 
+	/// the band mapping is the same for all pixels, compute it once
+	Resampling resampling(size(), newsize);
+
 	rebuildPixels();
-	for (int row = 0; row < height; ++row) {
-		for (int col = 0; col < width; ++col) {
-			/// delegate resizing to opencv, using mat headers over vectors
-			cv::Mat_<Value> src(pixels[row*width + col]),
-			                dst(ret.pixels[row*width + col]);
-			cv::resize(src, dst, cv::Size(1, newsize));
+	const size_t D = size();
+	tbb::parallel_for(tbb::blocked_range<int>(0, height),
+		[&](const tbb::blocked_range<int> &r) {
+		for (int row = r.begin(); row != r.end(); ++row) {
+			const Value *src = pixels[row];
+			Value *dst = ret.pixels[row];
+			for (int col = 0; col < width; ++col, src += D, dst += newsize)
+				resampling.apply(src, dst);
 		}
-	}
+	});
 
 	/// ret: write back pixel cache into bands
 	ret.applyCache();
 
 	/// interpolate wavelength metadata accordingly
-	{
-		cv::Mat_<float> tmpmeta1(cv::Size(meta.size(), 1)), tmpmeta2;
-		std::vector<BandDesc>::const_iterator it;
-		unsigned int i;
-		for (it = meta.begin(), i = 0; it != meta.end(); it++, i++) {
-			tmpmeta1(0, i) = it->center;
+	resampling.apply(meta, ret.meta);
+
+	return ret;
+}
+
+multi_img::Resampling::Resampling(size_t from, size_t to)
+	: lo(to), hi(to), w(to)
+{
+	// same sampling positions as cv::resize() with linear interpolation
+	const double scale = (double)from / to;
+	for (size_t j = 0; j < to; ++j) {
+		float fx = (float)((j + 0.5) * scale - 0.5);
+		int sx = (int)std::floor(fx);
+		fx -= sx;
+		if (sx < 0) {
+			sx = 0;
+			fx = 0.f;
 		}
-		cv::resize(tmpmeta1, tmpmeta2, cv::Size(newsize, 1));
-		for (size_t b = 0; b < newsize; b++) {
-			ret.meta[b] = BandDesc(tmpmeta2(0, b));
+		if (sx >= (int)from - 1) {
+			sx = (int)from - 1;
+			fx = 0.f;
 		}
+		lo[j] = sx;
+		hi[j] = std::min(sx + 1, (int)from - 1);
+		w[j] = fx;
 	}
+}
 
-	return ret;
+void multi_img::Resampling::apply(const std::vector<BandDesc> &src,
+                                  std::vector<BandDesc> &dst) const
+{
+	std::vector<Value> centers(src.size()), rcenters(w.size());
+	for (size_t i = 0; i < src.size(); ++i)
+		centers[i] = src[i].center;
+	apply(&centers[0], &rcenters[0]);
+	dst.resize(w.size());
+	for (size_t j = 0; j < w.size(); ++j)
+		dst[j] = BandDesc(rcenters[j]);
+}
+
+void multi_img::preprocess(const Preprocessing &steps, multi_img &target) const
+{
+	const size_t D = size();
+	assert(D > 0 && &target != this);
+
+	// output dimensionality and data range after each step
+	const bool gradient = steps.gradient && D > 1;
+	const size_t G = (gradient ? D - 1 : D);
+	const bool rescale = steps.bands > 0 && steps.bands < (int)G;
+	const size_t N = (rescale ? (size_t)steps.bands : G);
+
+	Value tminval = minval, tmaxval = maxval;
+	std::vector<BandDesc> tmeta(meta);
+	if (gradient) {
+		tmaxval = std::log(maxval);
+		tminval = -tmaxval;
+		tmeta.assign(G, BandDesc());
+		for (size_t i = 0; i < G; ++i) {
+			if (!meta[i].empty && !meta[i+1].empty)
+				tmeta[i] = BandDesc(meta[i].center, meta[i+1].center);
+		}
+	}
+
+	Resampling resampling(G, N);
+	if (rescale) {
+		// interpolate wavelength metadata accordingly
+		std::vector<BandDesc> rmeta;
+		resampling.apply(tmeta, rmeta);
+		tmeta.swap(rmeta);
+	}
+
+	// combined per-band illuminant coefficients
+	std::vector<Value> coeff;
+	if (steps.removeIllum > 0 || steps.addIllum > 0) {
+		coeff.assign(N, 1.f);
+		if (steps.removeIllum > 0) {
+			Illuminant il(steps.removeIllum);
+			// first get normalization right for our range
+			il.setNormalization(tmeta[0].center, tmeta[N-1].center);
+			for (size_t j = 0; j < N; ++j)
+				coeff[j] /= (Value)il.at(tmeta[j].center);
+		}
+		if (steps.addIllum > 0) {
+			Illuminant il(steps.addIllum);
+			il.setNormalization(tmeta[0].center, tmeta[N-1].center);
+			for (size_t j = 0; j < N; ++j)
+				coeff[j] *= (Value)il.at(tmeta[j].center);
+		}
+	}
+
+	target.init(height, width, N, tminval, tmaxval);
+	target.meta = tmeta;
+
+	// read band data directly, skipping the pixel cache
+	tbb::parallel_for(tbb::blocked_range<int>(0, height),
+		[&](const tbb::blocked_range<int> &r) {
+		std::vector<Value> v(D), out(N);
+		std::vector<const Value*> src(D);
+		std::vector<Value*> dst(N);
+		for (int row = r.begin(); row != r.end(); ++row) {
+			for (size_t d = 0; d < D; ++d)
+				src[d] = bands[d][row];
+			for (size_t j = 0; j < N; ++j)
+				dst[j] = target.bands[j][row];
+
+			for (int col = 0; col < width; ++col) {
+				for (size_t d = 0; d < D; ++d)
+					v[d] = src[d][col];
+
+				if (steps.normalize)
+					multi_img_simd::normalize_l2(&v[0], &v[0], D);
+
+				if (gradient) {
+					// get rid of negative values (when pixel value was 0)
+					multi_img_simd::log_clamped(&v[0], &v[0], D);
+					for (size_t d = 0; d < G; ++d)
+						v[d] = v[d+1] - v[d];
+				}
+
+				if (rescale)
+					resampling.apply(&v[0], &out[0]);
+				else
+					std::copy(v.begin(), v.begin() + N, out.begin());
+
+				if (!coeff.empty()) {
+					for (size_t j = 0; j < N; ++j)
+						out[j] *= coeff[j];
+				}
+
+				for (size_t j = 0; j < N; ++j)
+					dst[j][col] = out[j];
+			}
+		}
+	});
+	// cache was invalidated by init()
 }
 
 void multi_img::pixel2xyz(const Pixel &p, cv::Vec3f &v,
@@ -171,37 +325,11 @@ void multi_img::xyz2bgr(const cv::Vec3f &vs, cv::Vec3f &vd)
 
 cv::Mat_<cv::Vec3f> multi_img::bgr() const
 {
-	cv::Mat_<cv::Vec3f> xyz(height, width, 0.);
-	float greensum = 0.f;
-	for (size_t i = 0; i < size(); ++i) {
-		int idx = ((int)(meta[i].center + 0.5f) - 360) / 5;
-		if (idx < 0 || idx > 94)
-			continue;
-		Band::const_iterator src = bands[i].begin();
-		cv::Mat_<cv::Vec3f>::iterator dst = xyz.begin();
-		for (; dst != xyz.end(); ++src, ++dst) {
-			cv::Vec3f &v = *dst;
-			float intensity = (*src) * 1.f/maxval;
-			v[0] += CIEObserver::x[idx] * intensity;
-			v[1] += CIEObserver::y[idx] * intensity;
-			v[2] += CIEObserver::z[idx] * intensity;
-		}
-		greensum += CIEObserver::y[idx];
-	}
-
-	if (greensum == 0.f)
-		greensum = 1.f;
-
 	cv::Mat_<cv::Vec3f> bgr(height, width);
-	cv::Mat_<cv::Vec3f>::iterator src = xyz.begin();
-	cv::Mat_<cv::Vec3f>::iterator dst = bgr.begin();
-	for (; dst != bgr.end(); ++src, ++dst) {
-		cv::Vec3f &vs = *src;
-		cv::Vec3f &vd = *dst;
-		for (unsigned int i = 0; i < 3; ++i)
-			vs[i] /= greensum;
-		xyz2bgr(vs, vd);
-	}
+	XyzBgr computeBgr(bands, meta, maxval, bgr);
+	tbb::parallel_for(tbb::blocked_range2d<int>(0, height, 16,
+	                                            0, width, XyzBgr::TILE),
+	                  computeBgr);
 	return bgr;
 }
 
@@ -224,6 +352,7 @@ cv::Vec3f multi_img::bgr(const Pixel &p,
 
 void multi_img::apply_illuminant(const Illuminant& il, bool remove)
 {
+	detachBands();
 	if (remove) {
 		for (size_t i = 0; i < size(); ++i)
 			bands[i] /= (Value)il.at(meta[i].center);
@@ -236,7 +365,18 @@ void multi_img::apply_illuminant(const Illuminant& il, bool remove)
 	resetPixels();
 }
 
-std::vector<multi_img::Value> multi_img::getIllumCoeff(const Illuminant & il) const
+void multi_img_base::fitRange(const Range &data)
+{
+	minval = std::min(minval, data.min);
+	if (maxval <= 0) {
+		maxval = std::max(maxval, data.max);
+		return;
+	}
+	while (maxval < data.max)
+		maxval *= 2;
+}
+
+std::vector<multi_img::Value> multi_img_base::getIllumCoeff(const Illuminant & il) const
 {
 	std::vector<Value> ret(size());
 	for (size_t i = 0; i < size(); ++i)
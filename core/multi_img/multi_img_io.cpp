@@ -9,9 +9,13 @@
 #ifdef WITH_OPENCV2 // theoretically, vole could be built w/o opencv..
 
 #include "multi_img.h"
+#include "multi_img_simd.h"
 #include "qtopencv.h"
 
 #include <opencv2/highgui/highgui.hpp>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <string>
@@ -20,6 +24,26 @@
 std::vector<std::vector<unsigned short> >
 multi_img::export_ushort(bool useDataRange) const
 {
+	const cv::Mat_<unsigned short> src = export_ushort_mat(useDataRange);
+
+	std::vector<std::vector<unsigned short> > ret(src.rows);
+	tbb::parallel_for(tbb::blocked_range<int>(0, src.rows),
+		[&](const tbb::blocked_range<int> &r) {
+			for (int i = r.begin(); i != r.end(); ++i)
+				ret[i].assign(src[i], src[i] + src.cols);
+		});
+	return ret;
+}
+
+cv::Mat_<unsigned short>
+multi_img::export_ushort_mat(bool useDataRange, bool cache) const
+{
+	// the data range only changes along with the data
+	if (!quantized.empty() && quantizedDataRange == useDataRange
+	    && (useDataRange || (quantizedRange.min == minval
+	                         && quantizedRange.max == maxval)))
+		return quantized;
+
 	rebuildPixels();
 
 	Range range(minval, maxval);
@@ -28,15 +52,26 @@ multi_img::export_ushort(bool useDataRange) const
 		range = data_range();
 	}
 
+	// same factor and truncation as a plain conversion
 	Value scale = 65535.0/(range.max - range.min);
-	std::vector<std::vector<unsigned short> >
-			ret(width*height, std::vector<unsigned short>(size()));
+	if (!(range.max > range.min))
+		scale = 1.f;
 
-	std::vector<Pixel>::const_iterator it = pixels.begin();
-	for (size_t i = 0; it != pixels.end(); ++it, ++i)
-		for (size_t d = 0; d < size(); ++d)
-			ret[i][d] = ((*it)[d] - range.min) * scale;
+	const size_t D = size();
+	cv::Mat_<unsigned short> ret(width*height, (int)D);
+	// one image row of the cache maps to width consecutive pixel rows
+	tbb::parallel_for(tbb::blocked_range<int>(0, height),
+		[&](const tbb::blocked_range<int> &r) {
+			for (int row = r.begin(); row != r.end(); ++row)
+				multi_img_simd::quantize_u16(pixels[row], ret[row * width],
+				                             width * D, scale, range.min);
+		});
 
+	if (cache) {
+		quantized = ret;
+		quantizedRange = range;
+		quantizedDataRange = useDataRange;
+	}
 	return ret;
 }
 
@@ -49,20 +84,28 @@ QImage multi_img::export_qt(unsigned int band) const
 }
 #endif
 
-// read image part (what fits into one cv::Mat)
-int multi_img::read_mat(const cv::Mat &src)
+namespace {
+
+// find maximum of original data range, while we assume minimum is 0
+multi_img::Value depth_max(int depth)
 {
-	// find maximum of original data range, while we assume minimum is 0
-	Value srcmaxval = 0.;
 	// we expect CV_8U, CV_16U or floating point in [0..1]
-	switch (src.depth()) {
-		case CV_8U:	 { srcmaxval = 255.; break; }
-		case CV_16U: { srcmaxval = 65535.; break; }
+	switch (depth) {
+		case CV_8U:	 return 255.;
+		case CV_16U: return 65535.;
 		case CV_32F:
-		case CV_64F: { srcmaxval = 1.; break; }
+		case CV_64F: return 1.;
 		default:	assert(42 == 0);	// we don't handle other formats so far!
 	}
-	return read_mat(src, 0., srcmaxval);
+	return 1.;
+}
+
+}
+
+// read image part (what fits into one cv::Mat)
+int multi_img::read_mat(const cv::Mat &src)
+{
+	return read_mat(src, 0., depth_max(src.depth()));
 }
 
 // read image part (what fits into one cv::Mat)
@@ -77,80 +120,233 @@ int multi_img::read_mat(const cv::Mat &src, Value srcminval, Value srcmaxval)
 	width = src.cols;
 	height = src.rows;
 
-	// convert to right datatype, scaling
-	cv::Mat tmp;
-	src.convertTo(tmp, ValueType);
+	size_t cc = src.channels();
+	size_t first = bands.size();
+	bands.resize(first + cc);
+	convert_mat(src, srcminval, srcmaxval, &bands[first]);
+	return cc;
+}
 
-	// rescale data accordingly
-	if (srcminval == 0. && minval == 0.) {
-		if (maxval != srcmaxval) // evil comparison is o.k. here
-			tmp *= maxval/srcmaxval;
-	} else {
-		Value scale = (maxval - minval)/(srcmaxval - srcminval);
-		tmp = (tmp - srcminval) * scale;
-		if (minval != 0.)
-			tmp += minval;
-	}
-	
-	// split & add everything in at the end
-	size_t cc = tmp.channels();
+void multi_img::convert_mat(const cv::Mat &src, Value srcminval,
+							Value srcmaxval, Band *dst) const
+{
+	// convert to right datatype, scaling and shifting in one pass
+	Value scale = (maxval - minval)/(srcmaxval - srcminval);
+	Value shift = minval - srcminval * scale;
+
+	size_t cc = src.channels();
 	if (cc > 1) {
-		std::vector<Band> channels(cc);
+		cv::Mat tmp;
+		src.convertTo(tmp, ValueType, scale, shift);
+		// split into (possibly preallocated) target bands
+		std::vector<cv::Mat> channels(dst, dst + cc);
 		cv::split(tmp, channels);
-		bands.insert(bands.end(), channels.begin(), channels.end());
+		for (size_t c = 0; c < cc; ++c)
+			dst[c] = channels[c];
 	} else {
-		bands.push_back(tmp);
+		src.convertTo(dst[0], ValueType, scale, shift);
 	}
-	return cc;
+}
+
+bool multi_img::select_roi(const cv::Size &size, cv::Rect &roi)
+{
+	cv::Rect full(cv::Point(0, 0), size);
+	if (roi.area() == 0) {
+		roi = full;
+		return true;
+	}
+	roi &= full;
+	if (roi.area() == 0) {
+		std::cerr << "Region of interest lies outside of the image!"
+		          << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool multi_img::select_bands(int total, int &low, int &high)
+{
+	// if high is not specified, do not limit
+	if (high < 0)
+		high = total - 1;
+
+	// correct input?
+	if (low < 0 || low > high || high > total - 1) {
+		std::cerr << "Inconsistent bandlow, bandhigh values specified!"
+		          << std::endl;
+		return false;
+	}
+	return true;
 }
 
 // read multires. image into vector
 void multi_img::read_image(const std::vector<std::string> &files,
-						   const std::vector<BandDesc> &descs)
+						   const std::vector<BandDesc> &descs,
+						   const cv::Rect &roi, int bandlow, int bandhigh)
 {
+	/* with band descriptions, each file holds exactly one band. We can
+	   select the files to read right away. */
+	size_t filelow = 0, filehigh = files.size();
+	if (!descs.empty() && (bandlow > 0 || bandhigh >= 0)) {
+		if (!select_bands(files.size(), bandlow, bandhigh))
+			return;
+		filelow = bandlow;
+		filehigh = bandhigh + 1;
+		bandlow = 0;
+		bandhigh = -1;
+	}
+	const size_t nfiles = filehigh - filelow;
+
+	// outcome per file: its depth once converted, or one of these
+	enum { NOT_READ = -1, LOAD_FAILED = -2, SIZE_MISMATCH = -3,
+	       CHANNEL_MISMATCH = -4 };
+	std::vector<int> status(nfiles, NOT_READ);
+
+	/* the first readable file reveals spatial size and channel count. We
+	   expect all files alike, so target bands can be allocated right away and
+	   each file is released as soon as it is converted. */
+	cv::Size srcsize(width, height); // previous data, if any
+	cv::Mat head;
+	size_t start = 0;
+	for (; start < nfiles; ++start) {
+		head = cv::imread(files[filelow + start], -1); // flag -1: preserve format
+		if (head.empty()) {
+			status[start] = LOAD_FAILED;
+		} else if (srcsize.width > 0 && head.size() != srcsize) {
+			status[start] = SIZE_MISMATCH;
+			head.release();
+		} else {
+			break;
+		}
+	}
+
 	int channels = 0;
-	
-	for (size_t fi = 0; fi < files.size(); ++fi) {
-	    cv::Mat src = cv::imread(files[fi], -1); // flag -1: preserve format
+	if (!head.empty()) {
+		srcsize = head.size();
+		channels = head.channels();
+	}
+	const int total = (nfiles - start) * channels;
 
-		if (src.empty()) {
-			std::cerr << "ERROR: Failed to load " << files[fi] << std::endl;
-			continue;
+	// only convert what was asked for
+	cv::Rect area = roi;
+	const bool valid = total > 0 && select_roi(srcsize, area)
+	                   && select_bands(total, bandlow, bandhigh);
+	assert(!valid || empty() || area.size() == cv::Size(width, height));
+
+	const size_t first = size();
+	if (valid) {
+		// set spatial size, roi in source coordinates
+		width = area.width;
+		height = area.height;
+		this->roi = area;
+
+		if (minval == maxval) { // i.e. uninitialized
+			/* default to our favorite range */
+			minval = MULTI_IMG_MIN_DEFAULT; maxval = MULTI_IMG_MAX_DEFAULT;
 		}
 
-		// test spatial size
-		if (width > 0 && (src.cols != width || src.rows != height)) {
-			std::cerr << "ERROR: Size mismatch for image " << files[fi]
-						 << std::endl;
+		// preallocate target bands
+		bands.resize(first + bandhigh - bandlow + 1);
+		for (size_t i = first; i < size(); ++i)
+			bands[i].create(height, width);
+
+		// convert the selected channels of file i into their target bands
+		auto convert = [&](size_t i, const cv::Mat &full) {
+			const cv::Mat src = full(area);
+			const int o = (i - start) * channels;
+			const int low = std::max(bandlow, o);
+			const int high = std::min(bandhigh, o + channels - 1);
+			status[i] = src.depth();
+			if (low > high)
+				return;
+
+			Value srcmax = depth_max(src.depth());
+			Band *dst = &bands[first + low - bandlow];
+			if (low == o && high == o + channels - 1) {
+				convert_mat(src, 0., srcmax, dst);
+			} else {
+				std::vector<Band> tmp(channels);
+				convert_mat(src, 0., srcmax, &tmp[0]);
+				for (int c = low; c <= high; ++c)
+					tmp[c - o].copyTo(dst[c - low]);
+			}
+		};
+		convert(start, head);
+		head.release();
+
+		// decode and convert the remaining files concurrently
+		tbb::parallel_for(tbb::blocked_range<size_t>(start + 1, nfiles, 1),
+			[&](const tbb::blocked_range<size_t> &r) {
+				for (size_t i = r.begin(); i != r.end(); ++i) {
+					cv::Mat src = cv::imread(files[filelow + i], -1);
+					if (src.empty())
+						status[i] = LOAD_FAILED;
+					else if (src.size() != srcsize)
+						status[i] = SIZE_MISMATCH;
+					else if (src.channels() != channels)
+						status[i] = CHANNEL_MISMATCH;
+					else
+						convert(i, src);
+				}
+			});
+	}
+
+	// report in file order, drop bands reserved for files that failed
+	std::vector<BandDesc> filedescs;
+	for (size_t i = nfiles; i-- > 0;) {
+		const size_t fi = filelow + i;
+		if (status[i] >= 0) {
+			if (!descs.empty())
+				filedescs.insert(filedescs.begin(), descs[fi]);
 			continue;
 		}
-
-		channels = read_mat(src);
-		
+		if (status[i] == LOAD_FAILED)
+			std::cerr << "ERROR: Failed to load " << files[fi] << std::endl;
+		else if (status[i] == SIZE_MISMATCH)
+			std::cerr << "ERROR: Size mismatch for image " << files[fi]
+			          << std::endl;
+		else if (status[i] == CHANNEL_MISMATCH)
+			std::cerr << "ERROR: Channel count mismatch for image " << files[fi]
+			          << std::endl;
+		if (!valid || i < start)
+			continue;
+		const int o = (i - start) * channels;
+		const int low = std::max(bandlow, o);
+		const int high = std::min(bandhigh, o + channels - 1);
+		if (low <= high)
+			bands.erase(bands.begin() + first + low - bandlow,
+			            bands.begin() + first + high - bandlow + 1);
+	}
+	for (size_t i = 0; i < nfiles; ++i) {
+		if (status[i] < 0)
+			continue;
+		const size_t fi = filelow + i;
 		std::cerr << "Added " << files[fi] << ":\t" << channels
              << (channels == 1 ? " channel, " : " channels, ")
-			 << (src.depth() == CV_16U ? 16 : 8) << " bits";
+			 << (status[i] == CV_16U ? 16 : 8) << " bits";
 		if (descs.empty() || descs[fi].empty)
 			std::cerr << std::endl;
 		else
 			std::cerr << ", " << descs[fi].center << " nm" << std::endl;
 	}
+	if (!valid)
+		return;
 
 	/* invalidate pixel cache as pixel length has changed
 	   This step is _mandatory_ also to initialize cache containers */
-	pixels.clear();
+	pixels.release();
 	resetPixels();
 
 	/* add meta information if present. */
 	if (!descs.empty()) {
-		assert(meta.size() + descs.size() == size());
-		meta.insert(meta.end(), descs.begin(), descs.end());
+		assert(meta.size() + filedescs.size() == size());
+		meta.insert(meta.end(), filedescs.begin(), filedescs.end());
 	} else {
 		/* Hack: when input was single RGB image, we assume RGB peak wavelengths
 		         (from Hamamatsu) to enable re-calculation of RGB image */
 		// NOTE: for this to work as expected, incoming data still needs to
 		//	have linear response, which is not true for typical RGB imaging
-		if (files.size() == 1 && channels == 3) {
+		if (files.size() == 1 && channels == 3 && size() - first == 3) {
 			meta.push_back(BandDesc(460));
 			meta.push_back(BandDesc(540));
 			meta.push_back(BandDesc(620));
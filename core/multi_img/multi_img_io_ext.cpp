@@ -7,7 +7,10 @@
 */
 
 #include <multi_img.h>
+#include "multi_img_mapped.h"
 #include <opencv2/highgui/highgui.hpp>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
 
 #ifdef WITH_BOOST_FILESYSTEM
 	#include "boost/filesystem.hpp"
@@ -17,23 +20,37 @@
 	#include <sys/stat.h>
 #endif
 
+#include <cstring>
 #include <fstream>
 
 void multi_img::read_image(const std::string& filename)
+{
+	read_image(filename, cv::Rect());
+}
+
+void multi_img::read_image(const std::string& filename, const cv::Rect &roi,
+						   int bandlow, int bandhigh)
 {
 	std::pair<std::vector<std::string>, std::vector<BandDesc> > bands;
 
-	// try to read in file list first
+	// native cube files are cheapest to identify and read
+	if (probe_cube(filename)) {
+		read_image_cube(filename, roi, bandlow, bandhigh);
+		return;
+	}
+
+	// try to read in file list
 	bands = parse_filelist(filename);
 	if (bands.first.empty()) {
 		// maybe we got a .LAN image
-		if (read_image_lan(filename))
+		if (read_image_lan(filename, roi, bandlow, bandhigh))
 			return;
 		// maybe we got a single image as argument
-		read_image(std::vector<std::string>(1, filename));
+		read_image(std::vector<std::string>(1, filename),
+				   std::vector<BandDesc>(), roi, bandlow, bandhigh);
 	} else {
 		// read in multispectral image data
-		read_image(bands.first, bands.second);
+		read_image(bands.first, bands.second, roi, bandlow, bandhigh);
 	}
 }
 
@@ -44,49 +61,10 @@ struct hackstream : public std::ifstream {
 	{	read((char*)&d, sizeof(unsigned short));	}
 	void readui(unsigned int &d)
 	{	read((char*)&d, sizeof(unsigned int));		}
-	void reada(unsigned char *a, size_t num)
-	{	read((char*)a, sizeof(unsigned char)*num);	}
-	void reada(unsigned short *a, size_t num)
-	{	read((char*)a, sizeof(unsigned short)*num);	}
 };
 
-void multi_img::fill_bil(std::ifstream &in, unsigned short depth)
-{
-	/* read data in BIL (band interleaved by line) format */
-
-	// depth == 0 -> unsigned char; depth == 2 -> unsigned short (from .lan)
-
-	// we use either the 8bit or the 16bit array, have both for convenience. */
-	unsigned char *srow8 = new unsigned char[width];
-	unsigned short *srow16 = new unsigned short[width];
-	for (int y = 0; y < height; ++y) {
-		for (unsigned int d = 0; d < size(); ++d) {
-			multi_img::Value *drow = bands[d][y];
-			if (depth == 0)
-				in.read((char*)srow8, sizeof(unsigned char)*width);
-			else
-				in.read((char*)srow16, sizeof(unsigned short)*width);
-			for (int x = 0; x < width; ++x)
-				drow[x] = (Value)(depth == 0 ? srow8[x] : srow16[x]);
-		}
-	}
-	delete[] srow8;
-	delete[] srow16;
-	
-	/* rescale data according to minval/maxval */
-	Value srcmaxval = (depth == 0 ? (Value)255. : (Value)65535.);
-	Value scale = (maxval - minval)/srcmaxval;
-	for (unsigned int d = 0; d < size(); ++d) {
-		if (minval != 0.) {
-			bands[d] = bands[d] * scale + minval;
-		} else {
-			if (maxval != srcmaxval) // evil comp., doesn't hurt
-				bands[d] *= scale;
-		}
-	}
-}
-
-bool multi_img::read_image_lan(const std::string& filename)
+bool multi_img::read_image_lan(const std::string& filename,
+							   const cv::Rect &roi, int bandlow, int bandhigh)
 {
 	// we omit checks for data consistency
 	assert(empty());
@@ -106,7 +84,7 @@ bool multi_img::read_image_lan(const std::string& filename)
 	in.seekg(16);
 	in.readui(cols);
 	in.readui(rows);
-	in.seekg(128);
+	in.close();
 
 	if (depth != 0 && depth != 2) {
 		std::cout << "Data format not supported yet."
@@ -118,13 +96,245 @@ bool multi_img::read_image_lan(const std::string& filename)
 	             "Spatial size: " << cols << "x" << rows
 	          << "\t(" << (depth == 0 ? "8" : "16") << " bits)" << std::endl;
 
+	// raw data follows the 128 byte header, band interleaved by line
+	multi_img_mapped::Layout layout;
+	layout.width = cols;
+	layout.height = rows;
+	layout.bands = size;
+	layout.interleave = multi_img_mapped::BIL;
+	layout.type = (depth == 0 ? multi_img_mapped::UINT8
+	                          : multi_img_mapped::UINT16);
+	layout.offset = 128;
+
+	multi_img_mapped mapped(filename, layout);
+	if (mapped.empty())
+		return true; // still a LAN file
+	// rescale from format range to our default range
+	mapped.minval = MULTI_IMG_MIN_DEFAULT;
+	mapped.maxval = MULTI_IMG_MAX_DEFAULT;
+
+	// only read what was asked for (failure still means it was a LAN file)
+	read_mapped(mapped, roi, bandlow, bandhigh);
+	return true;
+}
+
+/* Native cube file layout (all fields in native byte order, a file written
+   on a host of other byte order is rejected by its version field):
+	char[8]   magic "GRBLCUBE"
+	uint32    version (1), width, height, bands
+	float32   minval, maxval
+	uint32    layout (0: BSQ float32), flags (reserved, 0)
+	uint64    offset of sample data
+	bands x   { float32 center, rangeStart, rangeEnd; uint8 empty }
+	padding to 64 byte boundary, followed by raw band data */
+namespace {
+const char cubeMagic[8] = { 'G', 'R', 'B', 'L', 'C', 'U', 'B', 'E' };
+const unsigned int cubeVersion = 1;
+const size_t cubeAlign = 64;
+// size of the fixed header fields and of one band description
+const size_t cubeFixedSize = 8 + 4*sizeof(unsigned int) + 2*sizeof(float)
+        + 2*sizeof(unsigned int) + sizeof(unsigned long long);
+const size_t cubeDescSize = 3*sizeof(float) + 1;
+
+struct CubeHeader {
+	unsigned int width, height, bands;
+	float minval, maxval;
+	unsigned int layout, flags;
+	unsigned long long offset;
+	std::vector<multi_img::BandDesc> meta;
+};
+
+template<typename T>
+inline bool readField(std::istream &in, T &v)
+{
+	return (bool)in.read((char*)&v, sizeof(T));
+}
+
+template<typename T>
+inline void writeField(std::ostream &out, const T &v)
+{
+	out.write((const char*)&v, sizeof(T));
+}
+
+bool readCubeHeader(const std::string &filename, CubeHeader &h)
+{
+	std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+	char magic[8];
+	if (!in.read(magic, 8) || memcmp(magic, cubeMagic, 8))
+		return false;
+	in.seekg(0, std::ios::end);
+	const unsigned long long fileSize = in.tellg();
+	in.seekg(8);
+
+	unsigned int version;
+	readField(in, version);
+	if (version != cubeVersion) {
+		std::cerr << "Cube file " << filename << " has unsupported version "
+		             "or byte order." << std::endl;
+		return false;
+	}
+
+	readField(in, h.width); readField(in, h.height); readField(in, h.bands);
+	readField(in, h.minval); readField(in, h.maxval);
+	readField(in, h.layout); readField(in, h.flags);
+	readField(in, h.offset);
+
+	// check sizes against the file before allocating anything
+	const unsigned long long samples = (fileSize >= h.offset
+	        ? (fileSize - h.offset) / sizeof(float) : 0);
+	if (in.fail() || h.layout != 0 || !h.width || !h.height || !h.bands
+	    || h.offset < cubeFixedSize + (unsigned long long)h.bands*cubeDescSize
+	    || (unsigned long long)h.width * h.height > samples / h.bands) {
+		std::cerr << "Cube file " << filename << " is corrupt." << std::endl;
+		return false;
+	}
+
+	h.meta.resize(h.bands);
+	for (unsigned int d = 0; d < h.bands; ++d) {
+		multi_img::BandDesc &b = h.meta[d];
+		unsigned char empty;
+		readField(in, b.center);
+		readField(in, b.rangeStart);
+		readField(in, b.rangeEnd);
+		readField(in, empty);
+		b.empty = (empty != 0);
+	}
+	if (in.fail()) {
+		std::cerr << "Cube file " << filename << " is corrupt." << std::endl;
+		return false;
+	}
+	return true;
+}
+}
+
+bool multi_img::probe_cube(const std::string &filename)
+{
+	std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+	char magic[8];
+	return in.read(magic, 8) && !memcmp(magic, cubeMagic, 8);
+}
+
+multi_img_mapped* multi_img::open_cube(const std::string &filename)
+{
+	CubeHeader h;
+	if (!readCubeHeader(filename, h))
+		return NULL;
+
+	multi_img_mapped::Layout layout;
+	layout.width = h.width;
+	layout.height = h.height;
+	layout.bands = h.bands;
+	layout.interleave = multi_img_mapped::BSQ;
+	layout.type = multi_img_mapped::FLOAT32;
+	layout.offset = h.offset;
+	const unsigned short probe = 1; // header and data are in host order
+	layout.bigEndian = (*(const unsigned char*)&probe == 0);
+	layout.srcmin = h.minval;
+	layout.srcmax = h.maxval;
+
+	multi_img_mapped *mapped = new multi_img_mapped(filename, layout, h.meta);
+	if (mapped->empty()) {
+		delete mapped;
+		return NULL;
+	}
+	mapped->minval = h.minval;
+	mapped->maxval = h.maxval;
+	return mapped;
+}
+
+bool multi_img::read_image_cube(const std::string &filename,
+								const cv::Rect &roi, int bandlow, int bandhigh)
+{
+	// we omit checks for data consistency
+	assert(empty());
+
+	multi_img_mapped *mapped = open_cube(filename);
+	if (!mapped)
+		return false;
+
+	// copy out of the mapping, bands are not converted
+	// (failure of selection still means it was a cube file)
+	read_mapped(*mapped, roi, bandlow, bandhigh);
+	delete mapped;
+	return true;
+}
+
+bool multi_img::read_mapped(const multi_img_mapped &source,
+							const cv::Rect &roi, int bandlow, int bandhigh)
+{
+	// only read what was asked for
+	cv::Rect area = roi;
+	if (!select_roi(cv::Size(source.width, source.height), area)
+	    || !select_bands(source.size(), bandlow, bandhigh))
+		return false;
+
 	// prepare image
-	init(rows, cols, size);
+	init(area.height, area.width, bandhigh - bandlow + 1,
+	     source.minval, source.maxval);
+	this->roi = area; // in source coordinates, as multi_img(source, roi) does
+	meta.assign(source.meta.begin() + bandlow,
+	            source.meta.begin() + bandhigh + 1);
 
-	// read raw data
-	fill_bil(in, depth);
+	// convert into the preallocated bands
+	source.readRegion(area, bandlow, bands);
+	return true;
+}
 
-	in.close();
+unsigned long long multi_img::write_cube_header(std::ostream &out,
+		int width, int height, Value minval, Value maxval,
+		const std::vector<BandDesc> &meta)
+{
+	const unsigned int w = width, h = height, d = meta.size();
+	const unsigned int layout = 0, flags = 0;
+
+	// header size rounded up to alignment of data block
+	unsigned long long offset = cubeFixedSize + d*cubeDescSize;
+	offset = (offset + cubeAlign - 1) / cubeAlign * cubeAlign;
+
+	out.write(cubeMagic, 8);
+	writeField(out, cubeVersion);
+	writeField(out, w); writeField(out, h); writeField(out, d);
+	writeField(out, minval); writeField(out, maxval);
+	writeField(out, layout); writeField(out, flags);
+	writeField(out, offset);
+	for (size_t i = 0; i < d; ++i) {
+		writeField(out, meta[i].center);
+		writeField(out, meta[i].rangeStart);
+		writeField(out, meta[i].rangeEnd);
+		writeField(out, (unsigned char)meta[i].empty);
+	}
+	std::vector<char> padding(offset - out.tellp(), 0);
+	out.write(padding.data(), padding.size());
+	return offset;
+}
+
+bool multi_img::write_cube(const std::string &filename) const
+{
+	std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary);
+	if (out.fail()) {
+		std::cerr << "Writing failed! Could not open " << filename << std::endl;
+		return false;
+	}
+
+	const unsigned int w = width, h = height, d = size();
+	write_cube_header(out, width, height, minval, maxval, meta);
+
+	// write raw band data
+	for (size_t i = 0; i < d; ++i) {
+		if (bands[i].isContinuous()) {
+			out.write((const char*)bands[i][0],
+			          (std::streamsize)w*h*sizeof(Value));
+			continue;
+		}
+		for (int y = 0; y < height; ++y)
+			out.write((const char*)bands[i][y], w*sizeof(Value));
+	}
+
+	if (out.fail()) {
+		std::cerr << "Writing failed! Error writing to " << filename
+		          << std::endl;
+		return false;
+	}
 	return true;
 }
 
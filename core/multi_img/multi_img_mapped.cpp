@@ -0,0 +1,344 @@
+#include "multi_img_mapped.h"
+#include "multi_img_simd.h"
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#ifdef __unix__
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+namespace {
+
+bool hostIsBigEndian()
+{
+	const unsigned short probe = 1;
+	return *(const unsigned char*)&probe == 0;
+}
+
+template<typename T>
+inline T swapBytes(T v)
+{
+	unsigned char *b = (unsigned char*)&v;
+	for (size_t i = 0; i < sizeof(T)/2; ++i)
+		std::swap(b[i], b[sizeof(T) - 1 - i]);
+	return v;
+}
+
+// convert n consecutive samples in native byte order
+template<typename T>
+inline void convertSamples(const unsigned char *src, float *dst, size_t n,
+                           float scale, float shift)
+{
+	for (size_t x = 0; x < n; ++x, src += sizeof(T)) {
+		T v;
+		memcpy(&v, src, sizeof(T)); // samples may be unaligned
+		dst[x] = (float)v * scale + shift;
+	}
+}
+
+template<typename T>
+inline void convertRow(const unsigned char *src, float *dst, size_t n,
+                       float scale, float shift)
+{
+	convertSamples<T>(src, dst, n, scale, shift);
+}
+
+template<>
+inline void convertRow<unsigned char>(const unsigned char *src, float *dst,
+                                      size_t n, float scale, float shift)
+{
+	multi_img_simd::unpack_u8(src, dst, n, scale, shift);
+}
+
+template<>
+inline void convertRow<unsigned short>(const unsigned char *src, float *dst,
+                                       size_t n, float scale, float shift)
+{
+	if ((size_t)src % sizeof(unsigned short) == 0)
+		multi_img_simd::unpack_u16((const unsigned short*)src, dst, n,
+		                           scale, shift);
+	else
+		convertSamples<unsigned short>(src, dst, n, scale, shift);
+}
+
+}
+
+multi_img_mapped::multi_img_mapped(const std::string &file,
+                                   const Layout &l,
+                                   const std::vector<BandDesc> &descs)
+	: layout(l), mapping(0), length(0), samples(0)
+{
+	width = 0;
+	height = 0;
+
+	size_t needed = l.offset + sampleSize()
+	                * (size_t)l.width * (size_t)l.height * l.bands;
+
+#ifdef __unix__
+	int fd = open(file.c_str(), O_RDONLY);
+	if (fd < 0) {
+		std::cerr << "ERROR: Failed to open " << file << std::endl;
+		return;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < needed) {
+		std::cerr << "ERROR: File " << file << " is smaller than expected ("
+		          << needed << " bytes)" << std::endl;
+		close(fd);
+		return;
+	}
+	/* private, writable mapping: bands handed out without copy may be
+	   modified by the caller without touching the file */
+	void *m = mmap(NULL, needed, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd); // mapping stays valid
+	if (m == MAP_FAILED) {
+		std::cerr << "ERROR: Failed to map " << file << std::endl;
+		return;
+	}
+	mapping = (unsigned char*)m;
+#else
+	/* no mmap available, fall back to reading the whole file */
+	std::cerr << "Warning: memory mapping not supported on this platform, "
+	             "reading " << file << " into memory." << std::endl;
+	std::ifstream in(file.c_str(), std::ios::in | std::ios::binary);
+	mapping = new unsigned char[needed];
+	in.read((char*)mapping, needed);
+	if ((size_t)in.gcount() < needed) {
+		std::cerr << "ERROR: File " << file << " is smaller than expected ("
+		          << needed << " bytes)" << std::endl;
+		delete[] mapping;
+		mapping = 0;
+		return;
+	}
+#endif
+	length = needed;
+	samples = mapping + l.offset;
+
+	// set spatial size
+	width = l.width;
+	height = l.height;
+
+	/* default to our favorite range */
+	minval = MULTI_IMG_MIN_DEFAULT;
+	maxval = MULTI_IMG_MAX_DEFAULT;
+
+	/* add meta information if present. */
+	if (!descs.empty()) {
+		assert(descs.size() == l.bands);
+		meta = descs;
+	} else {
+		meta.resize(l.bands);
+	}
+
+	std::cout << "Mapped " << file << ": " << l.bands << " bands "
+	          << (l.interleave == BSQ ? "BSQ" : (l.interleave == BIL ? "BIL" : "BIP"))
+	          << ", " << sampleSize()*8 << " bits. "
+	          << "Spatial size: " << width << "x" << height
+	          << "   (" << length/1048576. << " MB)" << std::endl;
+}
+
+multi_img_mapped::~multi_img_mapped()
+{
+	if (!mapping)
+		return;
+#ifdef __unix__
+	munmap(mapping, length);
+#else
+	delete[] mapping;
+#endif
+}
+
+size_t multi_img_mapped::size() const
+{
+	return (mapping ? layout.bands : 0);
+}
+
+bool multi_img_mapped::empty() const
+{
+	return size() == 0;
+}
+
+size_t multi_img_mapped::sampleSize() const
+{
+	switch (layout.type) {
+	case UINT8:   return 1;
+	case UINT16:  return 2;
+	case FLOAT32: return 4;
+	case INT16:   return 2;
+	}
+	return 0;
+}
+
+void multi_img_mapped::strides(size_t &b, size_t &r, size_t &c) const
+{
+	const size_t w = layout.width, h = layout.height, d = layout.bands;
+	switch (layout.interleave) {
+	case BSQ: b = w*h; r = w;   c = 1; break;
+	case BIL: b = w;   r = w*d; c = 1; break;
+	case BIP: b = 1;   r = w*d; c = d; break;
+	}
+}
+
+void multi_img_mapped::sourceRange(Value &srcmin, Value &srcmax) const
+{
+	if (layout.srcmax > layout.srcmin) {
+		srcmin = layout.srcmin;
+		srcmax = layout.srcmax;
+		return;
+	}
+	// we assume minimum is 0
+	srcmin = 0.f;
+	switch (layout.type) {
+	case UINT8:   srcmax = 255.f;   break;
+	case UINT16:  srcmax = 65535.f; break;
+	case INT16:   srcmax = 32767.f; break;
+	case FLOAT32: srcmax = 1.f;     break;
+	}
+}
+
+bool multi_img_mapped::isZeroCopy() const
+{
+	Value srcmin, srcmax;
+	sourceRange(srcmin, srcmax);
+	return layout.type == FLOAT32 && layout.interleave == BSQ
+	        && layout.bigEndian == hostIsBigEndian()
+	        && ((size_t)samples % sizeof(float)) == 0
+	        && minval == srcmin && maxval == srcmax;
+}
+
+template<typename T>
+void multi_img_mapped::convertBand(size_t band, const cv::Rect &roi,
+                                   Band &data) const
+{
+	size_t bs, rs, cs;
+	strides(bs, rs, cs);
+	const bool swap = (sizeof(T) > 1 && layout.bigEndian != hostIsBigEndian());
+
+	Value srcminval, srcmaxval;
+	sourceRange(srcminval, srcmaxval);
+	Value scale = (maxval - minval)/(srcmaxval - srcminval);
+	Value shift = minval - srcminval * scale;
+
+	data.create(roi.height, roi.width);
+	for (int y = 0; y < roi.height; ++y) {
+		const unsigned char *src = samples
+		        + (band*bs + (roi.y + y)*rs + roi.x*cs)*sizeof(T);
+		Value *dst = data[y];
+		// BSQ and BIL rows are contiguous, convert in one SIMD pass
+		if (cs == 1 && !swap) {
+			convertRow<T>(src, dst, roi.width, scale, shift);
+			continue;
+		}
+		for (int x = 0; x < roi.width; ++x, src += cs*sizeof(T)) {
+			T v;
+			memcpy(&v, src, sizeof(T)); // samples may be unaligned
+			if (swap)
+				v = swapBytes(v);
+			dst[x] = (Value)v * scale + shift;
+		}
+	}
+}
+
+void multi_img_mapped::getBand(size_t band, Band &data) const
+{
+	assert(band < size());
+
+	if (isZeroCopy()) {
+		const size_t offset = fileBand(band) * (size_t)width * (size_t)height;
+		data = Band(height, width, (Value*)samples + offset);
+		return;
+	}
+
+	convertRegion(band, cv::Rect(0, 0, width, height), data);
+}
+
+void multi_img_mapped::getBandRegion(size_t band, const cv::Rect &roi,
+                                     Band &data) const
+{
+	assert(band < size());
+
+	if (isZeroCopy()) {
+		Band full;
+		getBand(band, full);
+		scopeBand(full, roi, data);
+		return;
+	}
+
+	convertRegion(band, roi, data);
+}
+
+void multi_img_mapped::convertRegion(size_t band, const cv::Rect &roi,
+                                     Band &data) const
+{
+	band = fileBand(band);
+	switch (layout.type) {
+	case UINT8:   convertBand<unsigned char>(band, roi, data);  break;
+	case UINT16:  convertBand<unsigned short>(band, roi, data); break;
+	case FLOAT32: convertBand<float>(band, roi, data);          break;
+	case INT16:   convertBand<short>(band, roi, data);          break;
+	}
+}
+
+void multi_img_mapped::readRegion(const cv::Rect &roi, size_t first,
+                                  std::vector<Band> &out) const
+{
+	assert(first + out.size() <= size());
+	for (size_t i = 0; i < out.size(); ++i)
+		out[i].create(roi.height, roi.width);
+
+	const bool zeroCopy = isZeroCopy();
+	if (zeroCopy || layout.interleave == BSQ) {
+		tbb::parallel_for(tbb::blocked_range<size_t>(0, out.size(), 1),
+			[&](const tbb::blocked_range<size_t> &r) {
+				for (size_t i = r.begin(); i != r.end(); ++i) {
+					if (zeroCopy) {
+						Band src;
+						getBand(first + i, src);
+						src(roi).copyTo(out[i]);
+					} else {
+						convertRegion(first + i, roi, out[i]);
+					}
+				}
+			});
+		return;
+	}
+
+	/* all bands of a row lie next to each other. convertBand() writes into
+	   the row range of each target band, as create() keeps matching data */
+	tbb::parallel_for(tbb::blocked_range<int>(0, roi.height, 16),
+		[&](const tbb::blocked_range<int> &r) {
+			const cv::Rect stripe(roi.x, roi.y + r.begin(),
+			                      roi.width, (int)r.size());
+			for (size_t i = 0; i < out.size(); ++i) {
+				Band part = out[i].rowRange(r.begin(), r.end());
+				convertRegion(first + i, stripe, part);
+			}
+		});
+}
+
+void multi_img_mapped::setBandOrder(const std::vector<size_t> &order)
+{
+	assert(order.size() == size());
+	std::vector<BandDesc> descs(order.size());
+	for (size_t i = 0; i < order.size(); ++i)
+		descs[i] = meta[order[i]];
+	meta = descs;
+	bandOrder = order;
+}
+
+void multi_img_mapped::scopeBand(const Band &source, const cv::Rect &roi, Band &target) const
+{
+	/* always copy: the source may reference the mapping, which must not
+	   outlive this object, and we want to release a converted full band */
+	Band scoped(source, roi);
+	target = scoped.clone();
+}
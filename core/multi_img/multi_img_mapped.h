@@ -0,0 +1,126 @@
+#ifndef MULTI_IMG_MAPPED_H
+#define MULTI_IMG_MAPPED_H
+
+#include <multi_img.h>
+
+/// multi_img_base backed by a memory-mapped, uncompressed raw image cube
+/**
+	Band data is converted on request directly from the mapping, caching is
+	left to the page cache of the operating system. This keeps opening a file
+	instant and resident memory bounded regardless of the file size.
+
+	Supported are 8 bit and 16 bit unsigned integer, 16 bit signed integer
+	as well as 32 bit float samples, stored band sequential (BSQ), band interleaved by line (BIL) or
+	band interleaved by pixel (BIP), e.g. the payload of ENVI files.
+
+	Data is scaled from its source range to [minval, maxval] as in
+	multi_img::read_mat(). The source range defaults to the format range for
+	integer data (non-negative part for signed data) and to [0, 1] for float
+	data. Float BSQ data in native byte
+	order is handed out without copying if the source range equals
+	[minval, maxval].
+  */
+class multi_img_mapped : public multi_img_base {
+public:
+	/// sample order in the file
+	enum Interleave { BSQ, BIL, BIP };
+	/// sample data type
+	enum SampleType { UINT8, UINT16, FLOAT32, INT16 };
+
+	/// description of the raw file contents
+	struct Layout {
+		Layout() : width(0), height(0), bands(0), interleave(BSQ),
+		           type(UINT8), offset(0), bigEndian(false),
+		           srcmin(0.f), srcmax(0.f) {}
+		int width, height;
+		unsigned int bands;
+		Interleave interleave;
+		SampleType type;
+		/// start of sample data in the file (header size in bytes)
+		size_t offset;
+		/// byte order of multi-byte samples
+		bool bigEndian;
+		/// value range of the samples, format default if srcmax <= srcmin
+		float srcmin, srcmax;
+	};
+
+	/// maps the file, leaves the image empty if the file does not fit layout
+	multi_img_mapped(const std::string &file, const Layout &layout,
+	                 const std::vector<BandDesc> &descs
+	                     = std::vector<BandDesc>());
+
+	/// unmaps the file
+	virtual ~multi_img_mapped();
+
+	/// returns number of bands
+	virtual size_t size() const;
+
+	/// returns true if image is uninitialized
+	virtual bool empty() const;
+
+	/// returns one band (a reference into the mapping if possible)
+	virtual void getBand(size_t band, Band &data) const;
+
+	/// returns a copy of the roi part of the given band
+	virtual void scopeBand(const Band &source, const cv::Rect &roi, Band &target) const;
+
+	/// returns a copy of the roi part of one band, only that part is converted
+	virtual void getBandRegion(size_t band, const cv::Rect &roi, Band &data) const;
+
+	/// converts region roi of bands first, first + 1, ... into out
+	/** All bands in out are (re-)allocated and filled in parallel: band-wise
+		for BSQ, in stripes of rows for BIL and BIP, so that every thread reads
+		a contiguous part of the file. Only pages holding the region are
+		touched. **/
+	void readRegion(const cv::Rect &roi, size_t first,
+	                std::vector<Band> &out) const;
+
+	/// file layout as given on construction
+	const Layout& getLayout() const { return layout; }
+
+	/// hand out bands in a different order than stored in the file
+	/** Band i of the image is band order[i] of the file, band descriptions
+		are reordered along. order must be a permutation of all bands. **/
+	void setBandOrder(const std::vector<size_t> &order);
+
+protected:
+	/// size of one sample in bytes
+	size_t sampleSize() const;
+
+	/// distance between samples along band, row and column (in samples)
+	void strides(size_t &band, size_t &row, size_t &col) const;
+
+	/// source value range, resolving format defaults
+	void sourceRange(Value &srcmin, Value &srcmax) const;
+
+	/// true if band data can be used without conversion
+	bool isZeroCopy() const;
+
+	/// convert region roi of one band from raw samples of type T
+	template<typename T>
+	void convertBand(size_t band, const cv::Rect &roi, Band &data) const;
+
+	/// convert region roi of one band from raw samples of any type
+	void convertRegion(size_t band, const cv::Rect &roi, Band &data) const;
+
+	/// index of a band in the file
+	size_t fileBand(size_t band) const
+	{ return (bandOrder.empty() ? band : bandOrder[band]); }
+
+	Layout layout;
+	/// mapped file region and its length in bytes
+	unsigned char *mapping;
+	size_t length;
+	/// start of sample data in the mapping
+	const unsigned char *samples;
+	/// file band of each image band, empty for file order
+	std::vector<size_t> bandOrder;
+
+	MULTI_IMG_FRIENDS
+
+private:
+	multi_img_mapped(const multi_img_mapped &); // undefined
+	multi_img_mapped &operator=(const multi_img_mapped &); // undefined
+};
+
+#endif // MULTI_IMG_MAPPED_H
@@ -1,8 +1,12 @@
 #include "multi_img_offloaded.h"
 #include <opencv2/highgui/highgui.hpp>
+#include <mutex>
+
+const size_t multi_img_offloaded::CACHE_BUDGET;
 
 multi_img_offloaded::multi_img_offloaded(const std::vector<std::string> &files,
 										 const std::vector<BandDesc> &descs)
+	: cacheBudget(CACHE_BUDGET), prefetchDistance(1)
 {
 	int channels = 0;
 	width = 0;
@@ -92,13 +96,102 @@ void multi_img_offloaded::scopeBand(const Band &source, const cv::Rect &roi, Ban
 	target = scoped.clone();
 }
 
+multi_img_offloaded::~multi_img_offloaded()
+{
+	prefetcher.wait();
+}
+
+multi_img_offloaded::CacheStats multi_img_offloaded::cacheStats() const
+{
+	tbb::mutex::scoped_lock lock(cacheMutex);
+	return stats;
+}
+
+void multi_img_offloaded::setCacheLimits(size_t budget, int prefetch)
+{
+	tbb::mutex::scoped_lock lock(cacheMutex);
+	cacheBudget = budget;
+	prefetchDistance = prefetch;
+}
+
+bool multi_img_offloaded::lookup(size_t band, Band &data) const
+{
+	std::map<size_t, CacheList::iterator>::iterator it = cacheIndex.find(band);
+	if (it == cacheIndex.end())
+		return false;
+
+	cache.splice(cache.begin(), cache, it->second);
+	data = it->second->second;
+	return true;
+}
+
 void multi_img_offloaded::getBand(size_t band, Band &data) const
 {
-	cv::Mat src = cv::imread(bands[band].first, -1); // flag -1: preserve format
+	const size_t first = band - bands[band].second;
+	{
+		std::unique_lock<tbb::mutex> lock(cacheMutex);
+		data.release();
+		/* join a decode of the same file that is already running. A queued
+		   prefetch is claimed instead, no thread may be left to run it. */
+		while (!lookup(band, data) && pending.count(first))
+			decoded.wait(lock);
+		if (!data.empty()) {
+			++stats.hits;
+		} else {
+			++stats.misses;
+			queued.erase(first);
+			pending.insert(first);
+		}
+	}
 
-	if (src.empty()) {
-		std::cerr << "ERROR: Failed to load " << bands[band].first << std::endl;
+	if (data.empty() && !decode(band, data, false))
 		return;
+
+	prefetch(band);
+}
+
+void multi_img_offloaded::prefetch(size_t band) const
+{
+	tbb::mutex::scoped_lock lock(cacheMutex);
+	const size_t first = band - bands[band].second;
+	for (int d = 1; d <= prefetchDistance; ++d) {
+		size_t neighbors[] = { band + d, band - d };
+		for (int n = 0; n < 2; ++n) {
+			size_t b = neighbors[n];
+			if (b >= bands.size() || cacheIndex.count(b))
+				continue;
+			size_t f = b - bands[b].second;
+			if (f == first || pending.count(f) || queued.count(f))
+				continue;
+
+			queued.insert(f);
+			prefetcher.run([this, b, f] {
+				{
+					tbb::mutex::scoped_lock lock(cacheMutex);
+					// getBand() may have taken over meanwhile
+					if (!queued.erase(f))
+						return;
+					pending.insert(f);
+				}
+				Band dummy;
+				decode(b, dummy, true);
+			});
+		}
+	}
+}
+
+bool multi_img_offloaded::decode(size_t band, Band &data, bool prefetching) const
+{
+	const size_t first = band - bands[band].second;
+	const std::string &file = bands[band].first;
+	cv::Mat src = cv::imread(file, -1); // flag -1: preserve format
+
+	if (src.empty()) {
+		std::cerr << "ERROR: Failed to load " << file << std::endl;
+		tbb::mutex::scoped_lock lock(cacheMutex);
+		pending.erase(first);
+		decoded.notify_all();
+		return false;
 	}
 
 	// find original data range, we assume minimum is 0
@@ -111,9 +204,12 @@ void multi_img_offloaded::getBand(size_t band, Band &data) const
 	case CV_32F:
 	case CV_64F: { srcmaxval = 1.; break; }
 	default: // we don't handle other formats!
-		std::cerr << "Input data type of " << bands[band].first
+		std::cerr << "Input data type of " << file
 				  << " is not compatible!" << std::endl;
-		return;
+		tbb::mutex::scoped_lock lock(cacheMutex);
+		pending.erase(first);
+		decoded.notify_all();
+		return false;
 	}
 
 	// convert to right datatype, scaling
@@ -131,13 +227,40 @@ void multi_img_offloaded::getBand(size_t band, Band &data) const
 			tmp += minval;
 	}
 
-	// split & add everything in at the end
+	// split, keep all channels as the file is decoded as a whole anyway
 	size_t cc = tmp.channels();
-	if (cc > 1) {
-		std::vector<Band> channels(cc);
+	std::vector<Band> channels(cc);
+	if (cc > 1)
 		cv::split(tmp, channels);
-		data = channels[bands[band].second];
-	} else {
-		data = tmp;
+	else
+		channels[0] = tmp;
+	data = channels[bands[band].second];
+
+	tbb::mutex::scoped_lock lock(cacheMutex);
+	pending.erase(first);
+	decoded.notify_all();
+	if (prefetching)
+		++stats.prefetches;
+
+	for (size_t c = 0; c < cc && first + c < bands.size(); ++c) {
+		size_t b = first + c;
+		if (cacheIndex.count(b))
+			continue;
+		cache.push_front(std::make_pair(b, channels[c]));
+		cacheIndex[b] = cache.begin();
+		stats.bytes += channels[c].total() * sizeof(Value);
+	}
+	// the requested band is always kept on top
+	if (!prefetching)
+		lookup(band, data);
+
+	// evict least recently used bands, but never the most recent one
+	while (stats.bytes > cacheBudget && cache.size() > 1) {
+		const std::pair<size_t, Band> &victim = cache.back();
+		stats.bytes -= victim.second.total() * sizeof(Value);
+		cacheIndex.erase(victim.first);
+		cache.pop_back();
+		++stats.evictions;
 	}
+	return true;
 }
@@ -2,14 +2,20 @@
 #define MULTI_IMG_OFFLOADED_H
 
 #include <multi_img.h>
+#include <tbb/mutex.h>
+#include <tbb/task_group.h>
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <set>
 
 class multi_img_offloaded : public multi_img_base {
 public:
 	/// creates the multi_img with limited functionality and with bands offloaded to persistent storage
 	multi_img_offloaded(const std::vector<std::string> &files, const std::vector<BandDesc> &descs);
 
-	/// virtual destructor, does nothing
-	virtual ~multi_img_offloaded() {}
+	/// waits for pending prefetches
+	virtual ~multi_img_offloaded();
 
 	/// returns number of bands
 	virtual size_t size() const;
@@ -18,14 +24,65 @@ public:
 	virtual bool empty() const;
 
 	/// returns one band
-    virtual void getBand(size_t band, Band &data) const;
+	/** The band is shared with the band cache and must not be modified. */
+	virtual void getBand(size_t band, Band &data) const;
 
 	/// returns the roi part of the given band
 	virtual void scopeBand(const Band &source, const cv::Rect &roi, Band &target) const;
 
+	/// band cache statistics, see cacheStats()
+	struct CacheStats {
+		CacheStats() : hits(0), misses(0), prefetches(0), evictions(0),
+		               bytes(0) {}
+		size_t hits, misses, prefetches, evictions;
+		/// memory currently held by cached bands
+		size_t bytes;
+	};
+
+	/// returns band cache statistics
+	CacheStats cacheStats() const;
+
+	/// sets memory budget (in bytes) of the band cache and prefetch distance
+	/** Decoded bands are kept in least-recently-used order until budget is
+		exceeded. On each request, up to prefetch neighbouring bands in both
+		directions are decoded in the background. */
+	void setCacheLimits(size_t budget, int prefetch);
+
+	/// default memory budget of the band cache
+	static const size_t CACHE_BUDGET = 256 * 1048576;
+
 protected:
+	/// decodes the file of given band, caches all channels
+	/** The file must have been moved to pending by the caller.
+		returns false on failure. On success, data holds the requested band. */
+	bool decode(size_t band, Band &data, bool prefetching) const;
+
+	/// looks up band in cache, marks it as most recently used
+	bool lookup(size_t band, Band &data) const;
+
+	/// schedules background decoding of bands around given band
+	void prefetch(size_t band) const;
+
 	std::vector<std::pair<std::string, int> > bands;
 
+	/// cached bands in LRU order (front is most recent)
+	typedef std::list<std::pair<size_t, Band> > CacheList;
+	mutable CacheList cache;
+	mutable std::map<size_t, CacheList::iterator> cacheIndex;
+	mutable CacheStats stats;
+	/// first bands of files currently being decoded
+	/** Only decodes that are running are waited for. */
+	mutable std::set<size_t> pending;
+	/// first bands of files queued for prefetching, but not started yet
+	/** Whoever removes a file from here decodes it, see getBand(). */
+	mutable std::set<size_t> queued;
+	mutable tbb::mutex cacheMutex;
+	/// signalled whenever a file leaves pending
+	mutable std::condition_variable_any decoded;
+	mutable tbb::task_group prefetcher;
+	size_t cacheBudget;
+	int prefetchDistance;
+
 	MULTI_IMG_FRIENDS
 };
 
@@ -0,0 +1,56 @@
+/*
+	Sequential band access on a multi_img_offloaded with prefetching, run on a
+	single TBB thread. A getBand() that waits for a prefetch which is queued
+	but not started never returns in this setting.
+*/
+
+#include "multi_img_offloaded.h"
+#include <opencv2/highgui/highgui.hpp>
+#include <tbb/task_scheduler_init.h>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+
+int main()
+{
+	tbb::task_scheduler_init init(1);
+
+	const int nfiles = 16;
+	std::vector<std::string> files;
+	for (int i = 0; i < nfiles; ++i) {
+		std::ostringstream name;
+		name << "offloaded_test_" << i << ".png";
+		files.push_back(name.str());
+		cv::imwrite(files.back(), cv::Mat1b(8, 8, (uchar)(i * 10)));
+	}
+
+	int failed = 0;
+	{
+		multi_img_offloaded img(files, std::vector<multi_img::BandDesc>());
+		// a budget of two bands forces decoding on every pass
+		img.setCacheLimits(2 * 8 * 8 * sizeof(multi_img::Value), 2);
+
+		for (int pass = 0; pass < 3; ++pass) {
+			for (int i = 0; i < nfiles; ++i) {
+				int b = (pass % 2 ? nfiles - 1 - i : i);
+				multi_img::Band band;
+				img.getBand(b, band);
+				multi_img::Value expected = (multi_img::Value)(b * 10)
+				        * (img.maxval / 255.f);
+				if (band.empty() || band(3, 3) != expected) {
+					std::cerr << "band " << b << " has wrong content"
+					          << std::endl;
+					++failed;
+				}
+			}
+		}
+	}
+
+	for (size_t i = 0; i < files.size(); ++i)
+		std::remove(files[i].c_str());
+
+	if (failed)
+		return 1;
+	std::cout << "multi_img_offloaded: sequential access passed" << std::endl;
+	return 0;
+}
@@ -0,0 +1,97 @@
+#include "multi_img_packed.h"
+#include "multi_img_simd.h"
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <algorithm>
+#include <iostream>
+
+multi_img_packed::multi_img_packed(const multi_img_base &source,
+                                   Storage storage, bool fitToData)
+	: multi_img_base(source), storage(storage), bands(source.size())
+{
+	if (fitToData && !bands.empty()) {
+		std::vector<Range> ranges(bands.size());
+		tbb::parallel_for(tbb::blocked_range<size_t>(0, bands.size(), 1),
+			[&](const tbb::blocked_range<size_t> &r) {
+				for (size_t d = r.begin(); d != r.end(); ++d) {
+					Band src;
+					source.getBand(d, src);
+					double lo, hi;
+					cv::minMaxLoc(src, &lo, &hi);
+					ranges[d] = Range((Value)lo, (Value)hi);
+				}
+			});
+		Range data = ranges[0];
+		for (size_t d = 1; d < ranges.size(); ++d) {
+			data.min = std::min(data.min, ranges[d].min);
+			data.max = std::max(data.max, ranges[d].max);
+		}
+		fitRange(data);
+	}
+
+	scale = (maxval - minval) / 65535.f;
+	shift = minval;
+	if (scale <= 0.f)
+		scale = 1.f;
+
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, bands.size(), 1),
+		[&](const tbb::blocked_range<size_t> &r) {
+			for (size_t d = r.begin(); d != r.end(); ++d) {
+				Band src;
+				source.getBand(d, src);
+				PackedBand &dst = bands[d];
+				dst.create(height, width);
+				for (int y = 0; y < height; ++y) {
+					if (this->storage == UINT16)
+						multi_img_simd::pack_u16(src[y], dst[y], width,
+						                         scale, shift);
+					else
+						multi_img_simd::pack_f16(src[y], dst[y], width);
+				}
+			}
+		});
+
+	std::cout << "Packed " << size() << " bands ("
+	          << (storage == UINT16 ? "16 bit integer" : "half float")
+	          << "). Spatial size: " << width << "x" << height
+	          << "   (" << size()*width*height*sizeof(unsigned short)/1048576.
+	          << " MB)" << std::endl;
+}
+
+size_t multi_img_packed::size() const
+{
+	return bands.size();
+}
+
+bool multi_img_packed::empty() const
+{
+	return bands.empty();
+}
+
+void multi_img_packed::getBand(size_t band, Band &data) const
+{
+	getBandRegion(band, cv::Rect(0, 0, width, height), data);
+}
+
+void multi_img_packed::getBandRegion(size_t band, const cv::Rect &roi,
+                                     Band &data) const
+{
+	assert(band < size());
+	const PackedBand src(bands[band], roi);
+	data.create(roi.height, roi.width);
+	for (int y = 0; y < roi.height; ++y) {
+		if (storage == UINT16)
+			multi_img_simd::unpack_u16(src[y], data[y], roi.width,
+			                           scale, shift);
+		else
+			multi_img_simd::unpack_f16(src[y], data[y], roi.width);
+	}
+}
+
+void multi_img_packed::scopeBand(const Band &source, const cv::Rect &roi, Band &target) const
+{
+	// copy, the converted full band is temporary
+	Band scoped(source, roi);
+	target = scoped.clone();
+}
@@ -0,0 +1,65 @@
+#ifndef MULTI_IMG_PACKED_H
+#define MULTI_IMG_PACKED_H
+
+#include <multi_img.h>
+
+/// multi_img_base holding band data in 16 bit per sample
+/**
+	Bands are stored either as unsigned integers, quantized linearly over
+	[minval, maxval], or as IEEE half precision floats. This halves memory
+	requirements compared to multi_img, and there is no pixel cache. The
+	integer mode is lossless for data read from 16 bit (or less) sources.
+
+	getBand() widens the samples of a band to Value using SIMD kernels.
+  */
+class multi_img_packed : public multi_img_base {
+public:
+	/// sample storage format
+	enum Storage { UINT16, FLOAT16 };
+
+	/// packs all bands of the source image
+	/** Bands are read from source one at a time per thread, so a lazy
+		source (e.g. multi_img_mapped) is packed without a Value copy of the
+		whole image.
+		@arg fitToData widen the value range to the data first, see
+		     multi_img_base::fitRange(). Needs another pass over the source.
+	*/
+	multi_img_packed(const multi_img_base &source, Storage storage = UINT16,
+	                 bool fitToData = false);
+
+	virtual ~multi_img_packed() {}
+
+	/// returns number of bands
+	virtual size_t size() const;
+
+	/// returns true if image is uninitialized
+	virtual bool empty() const;
+
+	/// returns one band, converted to Value
+	virtual void getBand(size_t band, Band &data) const;
+
+	/// returns a copy of the roi part of the given band
+	virtual void scopeBand(const Band &source, const cv::Rect &roi, Band &target) const;
+
+	/// returns the roi part of one band, only that part is converted
+	virtual void getBandRegion(size_t band, const cv::Rect &roi, Band &data) const;
+
+	/// sample storage format as given on construction
+	Storage getStorage() const { return storage; }
+
+protected:
+	typedef cv::Mat_<unsigned short> PackedBand;
+
+	Storage storage;
+	/// quantization of UINT16 storage: value = sample * scale + shift
+	Value scale, shift;
+	std::vector<PackedBand> bands;
+
+	MULTI_IMG_FRIENDS
+
+private:
+	multi_img_packed(const multi_img_packed &); // undefined
+	multi_img_packed &operator=(const multi_img_packed &); // undefined
+};
+
+#endif // MULTI_IMG_PACKED_H
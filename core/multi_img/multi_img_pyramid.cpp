@@ -0,0 +1,72 @@
+#include "multi_img_pyramid.h"
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <algorithm>
+
+namespace multi_img_pyramid {
+
+size_t levelCount(const cv::Size &size, int minSide)
+{
+	size_t ret = 1;
+	for (int side = std::max(size.width, size.height); side > minSide;
+	     side = (side + 1) / 2)
+		++ret;
+	return ret;
+}
+
+size_t choose(double scale, size_t levels)
+{
+	size_t ret = 0;
+	while (ret + 1 < levels && scale <= 1. / (2 << ret))
+		++ret;
+	return ret;
+}
+
+namespace {
+
+// resize all bands of source to size with given interpolation
+multi_img* resized(const multi_img_base &source, const cv::Size &size,
+                   int interpolation, tbb::task_group_context &context)
+{
+	std::vector<multi_img::Band> bands(source.size());
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, bands.size(), 1),
+		[&](const tbb::blocked_range<size_t> &r) {
+			for (size_t d = r.begin(); d != r.end(); ++d) {
+				multi_img::Band band;
+				source.getBand(d, band);
+				cv::resize(band, bands[d], size, 0., 0., interpolation);
+			}
+		}, tbb::auto_partitioner(), context);
+	if (context.is_group_execution_cancelled())
+		return NULL;
+
+	multi_img *ret = new multi_img(size.height, size.width, bands.size());
+	ret->minval = source.minval;
+	ret->maxval = source.maxval;
+	ret->meta = source.meta;
+	for (size_t d = 0; d < bands.size(); ++d)
+		ret->setBand(d, bands[d]);
+	return ret;
+}
+
+}
+
+multi_img* downsample(const multi_img_base &source,
+                      tbb::task_group_context &context)
+{
+	const cv::Size size((source.width + 1) / 2, (source.height + 1) / 2);
+	return resized(source, size, cv::INTER_AREA, context);
+}
+
+multi_img* subsample(const multi_img_base &source, int maxSide,
+                     tbb::task_group_context &context)
+{
+	const int step = std::max(1, (std::max(source.width, source.height)
+	                              + maxSide - 1) / maxSide);
+	const cv::Size size((source.width + step - 1) / step,
+	                    (source.height + step - 1) / step);
+	return resized(source, size, cv::INTER_NEAREST, context);
+}
+
+}
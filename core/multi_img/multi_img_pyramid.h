@@ -0,0 +1,36 @@
+#ifndef MULTI_IMG_PYRAMID_H
+#define MULTI_IMG_PYRAMID_H
+
+#include <multi_img.h>
+#include <tbb/task_group.h>
+
+/// overview pyramid of downsampled images for display
+/**
+	Level l is the source downsampled by 2^l along both axes (area averaging),
+	level 0 is the source itself. Each level is computed from the previous
+	one, so the source is read only once when building all levels.
+  */
+namespace multi_img_pyramid {
+
+/// number of levels, including the source, down to a longer side of minSide
+size_t levelCount(const cv::Size &size, int minSide = 256);
+
+/// coarsest level that still has at least scale times the source resolution
+/** @param scale display size / source size, e.g. the current zoom factor
+	@param levels number of available levels, see levelCount() **/
+size_t choose(double scale, size_t levels);
+
+/// returns the source downsampled by 2, bands are processed in parallel
+/** Returns NULL if context is cancelled meanwhile. **/
+multi_img* downsample(const multi_img_base &source,
+                      tbb::task_group_context &context);
+
+/// nearest neighbor subsample with at most maxSide pixels along each side
+/** A quick preview, bands are processed in parallel. Returns NULL if
+	context is cancelled meanwhile. **/
+multi_img* subsample(const multi_img_base &source, int maxSide,
+                     tbb::task_group_context &context);
+
+}
+
+#endif // MULTI_IMG_PYRAMID_H
@@ -0,0 +1,535 @@
+#include "multi_img_simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+// runtime dispatch needs per-function target attributes (gcc, clang)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#define MULTI_IMG_SIMD_AVX2
+	#include <immintrin.h>
+#endif
+
+namespace multi_img_simd {
+
+namespace {
+
+// reciprocal of the norm, 1 for zero length vectors (as with cv::norm)
+inline float inverse_norm(double sum)
+{
+	double n = std::sqrt(sum);
+	if (n == 0.)
+		n = 1.;
+	return (float)(1. / n);
+}
+
+void normalize_l2_sse(const float *src, float *dst, size_t n)
+{
+	size_t i = 0;
+	__m128 acc = _mm_setzero_ps();
+	for (; i + 4 <= n; i += 4) {
+		__m128 v = _mm_loadu_ps(src + i);
+		acc = _mm_add_ps(acc, _mm_mul_ps(v, v));
+	}
+	float part[4];
+	_mm_storeu_ps(part, acc);
+	double sum = (double)part[0] + part[1] + part[2] + part[3];
+	for (; i < n; ++i)
+		sum += (double)src[i] * src[i];
+
+	const float f = inverse_norm(sum);
+	const __m128 vf = _mm_set1_ps(f);
+	for (i = 0; i + 4 <= n; i += 4)
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_loadu_ps(src + i), vf));
+	for (; i < n; ++i)
+		dst[i] = src[i] * f;
+}
+
+#ifdef MULTI_IMG_SIMD_AVX2
+__attribute__((target("avx2,fma")))
+void normalize_l2_avx2(const float *src, float *dst, size_t n)
+{
+	size_t i = 0;
+	__m256 acc = _mm256_setzero_ps();
+	for (; i + 8 <= n; i += 8) {
+		__m256 v = _mm256_loadu_ps(src + i);
+		acc = _mm256_fmadd_ps(v, v, acc);
+	}
+	float part[8];
+	_mm256_storeu_ps(part, acc);
+	double sum = 0.;
+	for (int k = 0; k < 8; ++k)
+		sum += part[k];
+	for (; i < n; ++i)
+		sum += (double)src[i] * src[i];
+
+	const float f = inverse_norm(sum);
+	const __m256 vf = _mm256_set1_ps(f);
+	for (i = 0; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_loadu_ps(src + i), vf));
+	for (; i < n; ++i)
+		dst[i] = src[i] * f;
+}
+#endif
+
+/* natural logarithm as in the Cephes library: split into exponent and
+   mantissa in [sqrt(0.5), sqrt(2)), then polynomial approximation.
+   input is clamped to >= 1, which is all we need and avoids special cases */
+const float log_p[9] = {
+	7.0376836292E-2f, -1.1514610310E-1f, 1.1676998740E-1f,
+	-1.2420140846E-1f, 1.4249322787E-1f, -1.6668057665E-1f,
+	2.0000714765E-1f, -2.4999993993E-1f, 3.3333331174E-1f
+};
+const float log_q1 = -2.12194440E-4f, log_q2 = 0.693359375f;
+const float sqrt_half = 0.707106781186547524f;
+
+__m128 log_clamped_sse(__m128 x)
+{
+	const __m128 one = _mm_set1_ps(1.f);
+	x = _mm_max_ps(x, one);
+
+	__m128i bits = _mm_castps_si128(x);
+	__m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23),
+	                                         _mm_set1_epi32(126)));
+	// mantissa in [0.5, 1)
+	x = _mm_castsi128_ps(_mm_or_si128(
+	        _mm_and_si128(bits, _mm_set1_epi32(0x007fffff)),
+	        _mm_set1_epi32(0x3f000000)));
+
+	// shift to [sqrt(0.5), sqrt(2)) - 1
+	__m128 mask = _mm_cmplt_ps(x, _mm_set1_ps(sqrt_half));
+	e = _mm_sub_ps(e, _mm_and_ps(one, mask));
+	x = _mm_add_ps(_mm_sub_ps(x, one), _mm_and_ps(x, mask));
+
+	__m128 z = _mm_mul_ps(x, x);
+	__m128 y = _mm_set1_ps(log_p[0]);
+	for (int k = 1; k < 9; ++k)
+		y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(log_p[k]));
+	y = _mm_mul_ps(_mm_mul_ps(y, x), z);
+	y = _mm_add_ps(y, _mm_mul_ps(e, _mm_set1_ps(log_q1)));
+	y = _mm_sub_ps(y, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+	x = _mm_add_ps(x, y);
+	return _mm_add_ps(x, _mm_mul_ps(e, _mm_set1_ps(log_q2)));
+}
+
+void log_clamped_sse(const float *src, float *dst, size_t n)
+{
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(dst + i, log_clamped_sse(_mm_loadu_ps(src + i)));
+	if (i < n) {
+		float in[4] = { 1.f, 1.f, 1.f, 1.f }, out[4];
+		std::copy(src + i, src + n, in);
+		_mm_storeu_ps(out, log_clamped_sse(_mm_loadu_ps(in)));
+		std::copy(out, out + (n - i), dst + i);
+	}
+}
+
+void unpack_u16_sse(const unsigned short *src, float *dst, size_t n,
+                    float scale, float shift)
+{
+	size_t i = 0;
+	const __m128 vs = _mm_set1_ps(scale), vt = _mm_set1_ps(shift);
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 8 <= n; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero));
+		__m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero));
+		_mm_storeu_ps(dst + i, _mm_add_ps(_mm_mul_ps(lo, vs), vt));
+		_mm_storeu_ps(dst + i + 4, _mm_add_ps(_mm_mul_ps(hi, vs), vt));
+	}
+	for (; i < n; ++i)
+		dst[i] = src[i] * scale + shift;
+}
+
+void unpack_u8_sse(const unsigned char *src, float *dst, size_t n,
+                   float scale, float shift)
+{
+	size_t i = 0;
+	const __m128 vs = _mm_set1_ps(scale), vt = _mm_set1_ps(shift);
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i w[2] = { _mm_unpacklo_epi8(v, zero),
+		                 _mm_unpackhi_epi8(v, zero) };
+		for (int k = 0; k < 2; ++k) {
+			__m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(w[k], zero));
+			__m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(w[k], zero));
+			_mm_storeu_ps(dst + i + 8*k, _mm_add_ps(_mm_mul_ps(lo, vs), vt));
+			_mm_storeu_ps(dst + i + 8*k + 4, _mm_add_ps(_mm_mul_ps(hi, vs), vt));
+		}
+	}
+	for (; i < n; ++i)
+		dst[i] = src[i] * scale + shift;
+}
+
+// saturate to 0..65535 and truncate, NaN becomes 0
+inline unsigned short saturate_u16(float v)
+{
+	return (unsigned short)(v > 0.f ? (v < 65535.f ? v : 65535.f) : 0.f);
+}
+
+void quantize_u16_sse(const float *src, unsigned short *dst, size_t n,
+                      float factor, float shift, float bias)
+{
+	size_t i = 0;
+	const __m128 vf = _mm_set1_ps(factor), vt = _mm_set1_ps(shift),
+	        vb = _mm_set1_ps(bias), zero = _mm_setzero_ps(),
+	        top = _mm_set1_ps(65535.f);
+	// SSE2 only packs signed, so pack around 32768 and flip the sign bit
+	const __m128i offset = _mm_set1_epi32(32768),
+	        flip = _mm_set1_epi16((short)0x8000);
+	for (; i + 8 <= n; i += 8) {
+		__m128i w[2];
+		for (int k = 0; k < 2; ++k) {
+			__m128 v = _mm_loadu_ps(src + i + 4*k);
+			v = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(v, vt), vf), vb);
+			// max() first: returns zero for NaN
+			v = _mm_min_ps(_mm_max_ps(v, zero), top);
+			w[k] = _mm_sub_epi32(_mm_cvttps_epi32(v), offset);
+		}
+		__m128i packed = _mm_xor_si128(_mm_packs_epi32(w[0], w[1]), flip);
+		_mm_storeu_si128((__m128i*)(dst + i), packed);
+	}
+	for (; i < n; ++i)
+		dst[i] = saturate_u16((src[i] - shift) * factor + bias);
+}
+
+// scalar IEEE half conversion, used without F16C and for the remainder
+inline float half_to_float(unsigned short h)
+{
+	const unsigned int sign = (unsigned int)(h & 0x8000) << 16;
+	const unsigned int exp = (h >> 10) & 0x1f, mant = h & 0x3ff;
+	unsigned int x;
+	float f;
+	if (exp == 0) {
+		// zero or subnormal, the latter is exact in float
+		f = mant * (1.f / 16777216.f);
+		memcpy(&x, &f, sizeof(x));
+		x |= sign;
+	} else if (exp == 31) {
+		x = sign | 0x7f800000 | (mant << 13);
+	} else {
+		x = sign | ((exp + 112) << 23) | (mant << 13);
+	}
+	memcpy(&f, &x, sizeof(f));
+	return f;
+}
+
+inline unsigned short float_to_half(float f)
+{
+	unsigned int x;
+	memcpy(&x, &f, sizeof(x));
+	const unsigned int sign = (x >> 16) & 0x8000;
+	const unsigned int fexp = (x >> 23) & 0xff;
+	unsigned int mant = x & 0x7fffff;
+	if (fexp == 0xff) // infinity or NaN
+		return sign | 0x7c00 | (mant ? 0x200 : 0);
+
+	const int exp = (int)fexp - 127 + 15;
+	if (exp >= 31) // overflow
+		return sign | 0x7c00;
+	if (exp <= 0) { // subnormal or zero
+		if (exp < -10)
+			return sign;
+		mant |= 0x800000;
+		const int shift = 14 - exp;
+		unsigned int h = mant >> shift;
+		const unsigned int rem = mant & ((1u << shift) - 1);
+		const unsigned int halfway = 1u << (shift - 1);
+		if (rem > halfway || (rem == halfway && (h & 1)))
+			++h;
+		return sign | h;
+	}
+	// rounding may carry into the exponent, which is correct
+	unsigned int h = ((unsigned int)exp << 10) | (mant >> 13);
+	const unsigned int rem = mant & 0x1fff;
+	if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+		++h;
+	return sign | h;
+}
+
+void unpack_f16_scalar(const unsigned short *src, float *dst, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		dst[i] = half_to_float(src[i]);
+}
+
+void pack_f16_scalar(const float *src, unsigned short *dst, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		dst[i] = float_to_half(src[i]);
+}
+
+#ifdef MULTI_IMG_SIMD_AVX2
+__attribute__((target("avx2,fma")))
+__m256 log_clamped_avx2(__m256 x)
+{
+	const __m256 one = _mm256_set1_ps(1.f);
+	x = _mm256_max_ps(x, one);
+
+	__m256i bits = _mm256_castps_si256(x);
+	__m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(
+	        _mm256_srli_epi32(bits, 23), _mm256_set1_epi32(126)));
+	x = _mm256_castsi256_ps(_mm256_or_si256(
+	        _mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)),
+	        _mm256_set1_epi32(0x3f000000)));
+
+	__m256 mask = _mm256_cmp_ps(x, _mm256_set1_ps(sqrt_half), _CMP_LT_OQ);
+	e = _mm256_sub_ps(e, _mm256_and_ps(one, mask));
+	x = _mm256_add_ps(_mm256_sub_ps(x, one), _mm256_and_ps(x, mask));
+
+	__m256 z = _mm256_mul_ps(x, x);
+	__m256 y = _mm256_set1_ps(log_p[0]);
+	for (int k = 1; k < 9; ++k)
+		y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(log_p[k]));
+	y = _mm256_mul_ps(_mm256_mul_ps(y, x), z);
+	y = _mm256_fmadd_ps(e, _mm256_set1_ps(log_q1), y);
+	y = _mm256_fnmadd_ps(z, _mm256_set1_ps(0.5f), y);
+	x = _mm256_add_ps(x, y);
+	return _mm256_fmadd_ps(e, _mm256_set1_ps(log_q2), x);
+}
+
+__attribute__((target("avx2,fma")))
+void log_clamped_avx2(const float *src, float *dst, size_t n)
+{
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(dst + i, log_clamped_avx2(_mm256_loadu_ps(src + i)));
+	if (i < n) {
+		float in[8] = { 1.f, 1.f, 1.f, 1.f, 1.f, 1.f, 1.f, 1.f }, out[8];
+		std::copy(src + i, src + n, in);
+		_mm256_storeu_ps(out, log_clamped_avx2(_mm256_loadu_ps(in)));
+		std::copy(out, out + (n - i), dst + i);
+	}
+}
+
+__attribute__((target("avx2,fma")))
+void unpack_u16_avx2(const unsigned short *src, float *dst, size_t n,
+                     float scale, float shift)
+{
+	size_t i = 0;
+	const __m256 vs = _mm256_set1_ps(scale), vt = _mm256_set1_ps(shift);
+	for (; i + 8 <= n; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+		__m256 f = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(v));
+		_mm256_storeu_ps(dst + i, _mm256_fmadd_ps(f, vs, vt));
+	}
+	for (; i < n; ++i)
+		dst[i] = src[i] * scale + shift;
+}
+
+__attribute__((target("avx2,fma")))
+void unpack_u8_avx2(const unsigned char *src, float *dst, size_t n,
+                    float scale, float shift)
+{
+	size_t i = 0;
+	const __m256 vs = _mm256_set1_ps(scale), vt = _mm256_set1_ps(shift);
+	for (; i + 8 <= n; i += 8) {
+		__m128i v = _mm_loadl_epi64((const __m128i*)(src + i));
+		__m256 f = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(v));
+		_mm256_storeu_ps(dst + i, _mm256_fmadd_ps(f, vs, vt));
+	}
+	for (; i < n; ++i)
+		dst[i] = src[i] * scale + shift;
+}
+
+// no FMA: results must match the SSE and scalar path exactly
+__attribute__((target("avx2")))
+void quantize_u16_avx2(const float *src, unsigned short *dst, size_t n,
+                       float factor, float shift, float bias)
+{
+	size_t i = 0;
+	const __m256 vf = _mm256_set1_ps(factor), vt = _mm256_set1_ps(shift),
+	        vb = _mm256_set1_ps(bias), zero = _mm256_setzero_ps(),
+	        top = _mm256_set1_ps(65535.f);
+	for (; i + 8 <= n; i += 8) {
+		__m256 v = _mm256_loadu_ps(src + i);
+		v = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(v, vt), vf), vb);
+		// max() first: returns zero for NaN
+		v = _mm256_min_ps(_mm256_max_ps(v, zero), top);
+		__m256i w = _mm256_cvttps_epi32(v);
+		__m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(w),
+		                                  _mm256_extracti128_si256(w, 1));
+		_mm_storeu_si128((__m128i*)(dst + i), packed);
+	}
+	for (; i < n; ++i)
+		dst[i] = saturate_u16((src[i] - shift) * factor + bias);
+}
+
+__attribute__((target("avx,f16c")))
+void unpack_f16_f16c(const unsigned short *src, float *dst, size_t n)
+{
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+		_mm256_storeu_ps(dst + i, _mm256_cvtph_ps(v));
+	}
+	for (; i < n; ++i)
+		dst[i] = half_to_float(src[i]);
+}
+
+__attribute__((target("avx,f16c")))
+void pack_f16_f16c(const float *src, unsigned short *dst, size_t n)
+{
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i v = _mm256_cvtps_ph(_mm256_loadu_ps(src + i),
+		                            _MM_FROUND_TO_NEAREST_INT);
+		_mm_storeu_si128((__m128i*)(dst + i), v);
+	}
+	for (; i < n; ++i)
+		dst[i] = float_to_half(src[i]);
+}
+#endif
+
+// kernels mapping float samples to float samples
+typedef void (*FloatKernel)(const float *, float *, size_t);
+
+FloatKernel select_normalize_l2()
+{
+#ifdef MULTI_IMG_SIMD_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return normalize_l2_avx2;
+#endif
+	return normalize_l2_sse;
+}
+
+FloatKernel select_log_clamped()
+{
+#ifdef MULTI_IMG_SIMD_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return log_clamped_avx2;
+#endif
+	return log_clamped_sse;
+}
+
+typedef void (*WidenKernel)(const unsigned short *, float *, size_t,
+                            float, float);
+
+WidenKernel select_unpack_u16()
+{
+#ifdef MULTI_IMG_SIMD_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return unpack_u16_avx2;
+#endif
+	return unpack_u16_sse;
+}
+
+typedef void (*ByteWidenKernel)(const unsigned char *, float *, size_t,
+                                float, float);
+
+ByteWidenKernel select_unpack_u8()
+{
+#ifdef MULTI_IMG_SIMD_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return unpack_u8_avx2;
+#endif
+	return unpack_u8_sse;
+}
+
+typedef void (*NarrowKernel)(const float *, unsigned short *, size_t,
+                            float, float, float);
+
+NarrowKernel select_quantize_u16()
+{
+#ifdef MULTI_IMG_SIMD_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return quantize_u16_avx2;
+#endif
+	return quantize_u16_sse;
+}
+
+typedef void (*HalfWidenKernel)(const unsigned short *, float *, size_t);
+typedef void (*HalfNarrowKernel)(const float *, unsigned short *, size_t);
+
+bool have_f16c()
+{
+#ifdef MULTI_IMG_SIMD_AVX2
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+#else
+	return false;
+#endif
+}
+
+HalfWidenKernel select_unpack_f16()
+{
+#ifdef MULTI_IMG_SIMD_AVX2
+	if (have_f16c())
+		return unpack_f16_f16c;
+#endif
+	return unpack_f16_scalar;
+}
+
+HalfNarrowKernel select_pack_f16()
+{
+#ifdef MULTI_IMG_SIMD_AVX2
+	if (have_f16c())
+		return pack_f16_f16c;
+#endif
+	return pack_f16_scalar;
+}
+}
+
+void normalize_l2(const float *src, float *dst, size_t n)
+{
+	// chosen once, initialization is thread-safe
+	static const FloatKernel kernel = select_normalize_l2();
+	kernel(src, dst, n);
+}
+
+void log_clamped(const float *src, float *dst, size_t n)
+{
+	static const FloatKernel kernel = select_log_clamped();
+	kernel(src, dst, n);
+}
+
+void unpack_u16(const unsigned short *src, float *dst, size_t n,
+                float scale, float shift)
+{
+	static const WidenKernel kernel = select_unpack_u16();
+	kernel(src, dst, n, scale, shift);
+}
+
+void unpack_u8(const unsigned char *src, float *dst, size_t n,
+               float scale, float shift)
+{
+	static const ByteWidenKernel kernel = select_unpack_u8();
+	kernel(src, dst, n, scale, shift);
+}
+
+void pack_u16(const float *src, unsigned short *dst, size_t n,
+              float scale, float shift)
+{
+	static const NarrowKernel kernel = select_quantize_u16();
+	kernel(src, dst, n, 1.f / scale, shift, 0.5f);
+}
+
+void quantize_u16(const float *src, unsigned short *dst, size_t n,
+                  float factor, float shift)
+{
+	static const NarrowKernel kernel = select_quantize_u16();
+	kernel(src, dst, n, factor, shift, 0.f);
+}
+
+void unpack_f16(const unsigned short *src, float *dst, size_t n)
+{
+	static const HalfWidenKernel kernel = select_unpack_f16();
+	kernel(src, dst, n);
+}
+
+void pack_f16(const float *src, unsigned short *dst, size_t n)
+{
+	static const HalfNarrowKernel kernel = select_pack_f16();
+	kernel(src, dst, n);
+}
+
+}
@@ -0,0 +1,51 @@
+#ifndef MULTI_IMG_SIMD_H
+#define MULTI_IMG_SIMD_H
+
+#include <cstddef>
+
+/// SIMD kernels on single spectra and on packed sample storage
+namespace multi_img_simd {
+
+/// scale vector src of length n to unit L2 norm, write to dst
+/** dst may equal src. Vectors of zero length are copied unchanged.
+	Uses AVX2 if supported by the CPU at runtime, SSE otherwise. **/
+void normalize_l2(const float *src, float *dst, size_t n);
+
+/// dst[i] = max(log(src[i]), 0), i.e. log of values clamped to >= 1
+/** dst may equal src. Uses AVX2 if supported by the CPU at runtime, SSE2
+	otherwise. Accuracy is within a few ulp of std::log for finite input. **/
+void log_clamped(const float *src, float *dst, size_t n);
+
+/// widen n 16 bit samples to float: dst[i] = src[i] * scale + shift
+/** Uses AVX2 if supported by the CPU at runtime, SSE2 otherwise. **/
+void unpack_u16(const unsigned short *src, float *dst, size_t n,
+                float scale, float shift);
+
+/// widen n 8 bit samples to float: dst[i] = src[i] * scale + shift
+/** Uses AVX2 if supported by the CPU at runtime, SSE2 otherwise. **/
+void unpack_u8(const unsigned char *src, float *dst, size_t n,
+               float scale, float shift);
+
+/// quantize n floats to 16 bit: dst[i] = round((src[i] - shift) / scale)
+/** Values outside of the representable range are saturated. Uses AVX2 if
+	supported by the CPU at runtime, SSE2 otherwise. **/
+void pack_u16(const float *src, unsigned short *dst, size_t n,
+              float scale, float shift);
+
+/// quantize n floats to 16 bit: dst[i] = (src[i] - shift) * factor
+/** Truncates like a plain conversion, values outside of the representable
+	range are saturated. Uses AVX2 if supported by the CPU at runtime, SSE2
+	otherwise. **/
+void quantize_u16(const float *src, unsigned short *dst, size_t n,
+                  float factor, float shift);
+
+/// convert n IEEE half precision samples to float
+/** Uses F16C if supported by the CPU at runtime. **/
+void unpack_f16(const unsigned short *src, float *dst, size_t n);
+
+/// convert n floats to IEEE half precision (round to nearest even)
+void pack_f16(const float *src, unsigned short *dst, size_t n);
+
+}
+
+#endif // MULTI_IMG_SIMD_H
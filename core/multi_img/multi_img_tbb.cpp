@@ -1,5 +1,6 @@
 #include "multi_img_tbb.h"
 #include "cieobserver.h"
+#include "multi_img_simd.h"
 
 #include <multi_img.h>
 #include <multi_img/illuminant.h>
@@ -11,45 +12,57 @@
 
 void RebuildPixels::operator()(const tbb::blocked_range<size_t> &r) const
 {
+	const size_t D = multi.bands.size();
 	for (size_t d = r.begin(); d != r.end(); ++d) {
 		multi_img::Band &src = multi.bands[d];
 		if (src.empty()) {
 			return;
 		}
-		multi_img::Band::const_iterator it; size_t i;
-		for (it = src.begin(), i = 0; it != src.end(); ++it, ++i)
-			multi.pixels[i][d] = *it;
+		for (int row = 0; row < multi.height; ++row) {
+			const multi_img::Value *srow = src[row];
+			multi_img::Value *dst = multi.pixels[row] + d;
+			for (int col = 0; col < multi.width; ++col)
+				dst[col*D] = srow[col];
+		}
 	}
 }
 
 void RebuildPixels::operator()(const tbb::blocked_range2d<int> &r) const
 {
+	const size_t D = multi.bands.size();
 	for (int row = r.rows().begin(); row != r.rows().end(); ++row) {
-		int loc = row * multi.width;
-		for (int col = r.cols().begin(); col != r.cols().end(); ++col) {
-			for (size_t d = 0; d < multi.size(); ++d)
-				multi.pixels[loc + col][d] = multi.bands[d](row, col);
+		multi_img::Value *dst = multi.pixels[row];
+		for (size_t d = 0; d < D; ++d) {
+			const multi_img::Value *src = multi.bands[d][row];
+			for (int col = r.cols().begin(); col != r.cols().end(); ++col)
+				dst[col*D + d] = src[col];
 		}
 	}
 }
 
 void ApplyCache::operator()(const tbb::blocked_range<size_t> &r) const
 {
+	const size_t D = multi.bands.size();
 	for (size_t d = r.begin(); d != r.end(); ++d) {
 		multi_img::Band &dst = multi.bands[d];
-		multi_img::Band::iterator it; size_t i;
-		for (it = dst.begin(), i = 0; it != dst.end(); ++it, ++i)
-			*it = multi.pixels[i][d];
+		for (int row = 0; row < multi.height; ++row) {
+			const multi_img::Value *src = multi.pixels[row] + d;
+			multi_img::Value *drow = dst[row];
+			for (int col = 0; col < multi.width; ++col)
+				drow[col] = src[col*D];
+		}
 	}
 }
 
 void ApplyCache::operator()(const tbb::blocked_range2d<int> &r) const
 {
+	const size_t D = multi.bands.size();
 	for (int row = r.rows().begin(); row != r.rows().end(); ++row) {
-		int loc = row * multi.width;
-		for (int col = r.cols().begin(); col != r.cols().end(); ++col) {
-			for (size_t d = 0; d < multi.size(); ++d)
-				multi.bands[d](row, col) = multi.pixels[loc + col][d];
+		const multi_img::Value *src = multi.pixels[row];
+		for (size_t d = 0; d < D; ++d) {
+			multi_img::Value *dst = multi.bands[d][row];
+			for (int col = r.cols().begin(); col != r.cols().end(); ++col)
+				dst[col] = src[col*D + d];
 		}
 	}
 }
@@ -73,6 +86,87 @@ void DetermineRange::join(DetermineRange &toJoin)
 }
 
 
+DetermineStatistics::DetermineStatistics(multi_img &multi)
+	: multi(multi)
+{
+	init();
+}
+
+DetermineStatistics::DetermineStatistics(DetermineStatistics &toSplit,
+                                         tbb::split)
+	: multi(toSplit.multi)
+{
+	init();
+}
+
+void DetermineStatistics::init()
+{
+	const int D = (int)multi.size(), B = multi_img::BandStatistics::BINS;
+	range.assign(D, multi_img::Range(multi_img::ValueMax,
+	                                 multi_img::ValueMin));
+	sum.assign(D, 0.);
+	hist = cv::Mat_<int>::zeros(D, B + 2);
+	histRange = multi_img::Range(multi.minval, multi.maxval);
+	if (!(histRange.max > histRange.min)) // degenerate range
+		histRange.max = histRange.min + 1.f;
+	binScale = B / ((double)histRange.max - histRange.min);
+}
+
+void DetermineStatistics::operator()(const tbb::blocked_range2d<int> &r)
+{
+	const int B = multi_img::BandStatistics::BINS;
+	const multi_img::Value lo = histRange.min, hi = histRange.max;
+	for (int d = r.rows().begin(); d != r.rows().end(); ++d) {
+		multi_img::Range &rg = range[d];
+		int *h = hist[d];
+		double s = 0.;
+		for (int row = r.cols().begin(); row != r.cols().end(); ++row) {
+			const multi_img::Value *src = multi.bands[d][row];
+			for (int col = 0; col < multi.width; ++col) {
+				const multi_img::Value v = src[col];
+				rg.min = std::min(rg.min, v);
+				rg.max = std::max(rg.max, v);
+				s += v;
+
+				int bin;
+				if (v < lo) {
+					bin = 0;
+				} else if (v > hi) {
+					bin = B + 1;
+				} else {
+					// value hi goes into the last regular bin
+					bin = std::min((int)((v - lo) * binScale), B - 1) + 1;
+				}
+				++h[bin];
+			}
+		}
+		sum[d] += s;
+	}
+}
+
+void DetermineStatistics::join(DetermineStatistics &toJoin)
+{
+	for (size_t d = 0; d < range.size(); ++d) {
+		range[d].min = std::min(range[d].min, toJoin.range[d].min);
+		range[d].max = std::max(range[d].max, toJoin.range[d].max);
+		sum[d] += toJoin.sum[d];
+	}
+	hist += toJoin.hist;
+}
+
+multi_img::BandStatistics DetermineStatistics::result() const
+{
+	multi_img::BandStatistics ret;
+	ret.count = (size_t)multi.width * multi.height;
+	ret.range = range;
+	ret.mean.resize(sum.size());
+	for (size_t d = 0; d < sum.size(); ++d)
+		ret.mean[d] = (ret.count > 0 ? sum[d] / ret.count : 0.);
+	ret.hist = hist;
+	ret.histRange = histRange;
+	return ret;
+}
+
 void Xyz::operator()(const tbb::blocked_range2d<int> &r) const
 {
 	float intensity;
@@ -126,44 +220,98 @@ void Bgr::operator()(const tbb::blocked_range2d<int> &r) const
 	}
 }
 
+XyzBgr::XyzBgr(const std::vector<multi_img::Band> &b,
+               const std::vector<multi_img::BandDesc> &meta,
+               multi_img::Value maxval, cv::Mat_<cv::Vec3f> &bgr)
+	: bgr(bgr)
+{
+	float greensum = 0.f;
+	for (size_t i = 0; i < b.size(); ++i) {
+		int idx = ((int)(meta[i].center + 0.5f) - 360) / 5;
+		if (idx < 0 || idx > 94)
+			continue;
+		bands.push_back(&b[i]);
+		weights.push_back(cv::Vec3f(CIEObserver::x[idx], CIEObserver::y[idx],
+		                            CIEObserver::z[idx]));
+		greensum += CIEObserver::y[idx];
+	}
+
+	if (greensum == 0.f)
+		greensum = 1.f;
 
+	const float factor = 1.f / (maxval * greensum);
+	for (size_t i = 0; i < weights.size(); ++i)
+		weights[i] *= factor;
+}
 
-void Grad::operator ()(const tbb::blocked_range<size_t> &r) const
+void XyzBgr::operator()(const tbb::blocked_range2d<int> &r) const
 {
-	for (size_t i = r.begin(); i != r.end(); ++i) {
-		//target.bands[i] = source.bands[i + 1] - source.bands[i];
-		cv::subtract(source.bands[i + 1], source.bands[i], target.bands[i]);
-		if (!source.meta[i].empty && !source.meta[i + 1].empty) {
-			target.meta[i] = multi_img::BandDesc(
-				source.meta[i].center, source.meta[i + 1].center);
+	float x[TILE], y[TILE], z[TILE];
+	const size_t D = bands.size();
+	for (int i = r.rows().begin(); i != r.rows().end(); ++i) {
+		cv::Vec3f *dst = bgr[i];
+		for (int j0 = r.cols().begin(); j0 < r.cols().end(); j0 += TILE) {
+			const int n = std::min(TILE, r.cols().end() - j0);
+			std::fill(x, x + n, 0.f);
+			std::fill(y, y + n, 0.f);
+			std::fill(z, z + n, 0.f);
+
+			// accumulate this part of the row over all bands
+			for (size_t d = 0; d < D; ++d) {
+				const multi_img::Value *src = (*bands[d])[i] + j0;
+				const float wx = weights[d][0], wy = weights[d][1],
+				            wz = weights[d][2];
+				for (int k = 0; k < n; ++k) {
+					x[k] += wx * src[k];
+					y[k] += wy * src[k];
+					z[k] += wz * src[k];
+				}
+			}
+
+			for (int k = 0; k < n; ++k)
+				multi_img::xyz2bgr(cv::Vec3f(x[k], y[k], z[k]), dst[j0 + k]);
 		}
 	}
 }
 
 
-void Log::operator ()(const tbb::blocked_range<size_t> &r) const
+
+void LogGrad::operator()(const tbb::blocked_range2d<int> &r) const
 {
-	{
-		for (size_t i = r.begin(); i != r.end(); ++i) {
-			cv::log(source.bands[i], target.bands[i]);
-			//target.bands[i] = cv::max(target.bands[i], 0.);
-			cv::max(target.bands[i], 0., target.bands[i]);
+	float a[TILE], b[TILE];
+	const size_t G = target.size();
+	for (int row = r.rows().begin(); row != r.rows().end(); ++row) {
+		for (int j0 = r.cols().begin(); j0 < r.cols().end(); j0 += TILE) {
+			const int n = std::min(TILE, r.cols().end() - j0);
+			float *prev = a, *cur = b;
+			multi_img_simd::log_clamped(source.bands[0][row] + j0, prev, n);
+			for (size_t d = 0; d < G; ++d) {
+				multi_img_simd::log_clamped(source.bands[d + 1][row] + j0,
+				                            cur, n);
+				multi_img::Value *dst = target.bands[d][row] + j0;
+				for (int k = 0; k < n; ++k)
+					dst[k] = cur[k] - prev[k];
+				std::swap(prev, cur);
+			}
 		}
 	}
 }
 
 void NormL2::operator()(const tbb::blocked_range2d<int> &r) const
 {
+	const size_t D = source.size();
+	const int cols = r.cols().begin();
 	for (int row = r.rows().begin(); row != r.rows().end(); ++row) {
-		for (int col = r.cols().begin(); col != r.cols().end(); ++col) {
-			cv::Mat_<multi_img::Value> src(
-						source.pixels[row * source.width + col], false);
-			cv::Mat_<multi_img::Value> dst(
-						target.pixels[row * source.width + col], false);
-			double n = cv::norm(src, cv::NORM_L2);
-			if (n == 0.)
-				n = 1.;
-			dst = src / n;
+		const multi_img::Value *src = source.cachePtr(row, cols);
+		multi_img::Value *dst = target.cachePtr(row, cols);
+		for (int col = cols; col != r.cols().end(); ++col) {
+			multi_img_simd::normalize_l2(src, dst, D);
+			if (writeBands) {
+				for (size_t d = 0; d < D; ++d)
+					target.bands[d](row, col) = dst[d];
+			}
+			src += D;
+			dst += D;
 		}
 	}
 }
@@ -196,35 +344,103 @@ void Illumination::operator ()(const tbb::blocked_range<size_t> &r) const
 }
 
 
-void PcaProjection::operator ()(const tbb::blocked_range<size_t> &r) const
+Covariance::Covariance(multi_img &multi, int step)
+	: sum(1, (int)multi.size(), 0.),
+	  scatter((int)multi.size(), (int)multi.size(), 0.),
+	  count(0), multi(multi), step(step) {}
+
+Covariance::Covariance(Covariance &toSplit, tbb::split)
+	: sum(1, (int)toSplit.multi.size(), 0.),
+	  scatter((int)toSplit.multi.size(), (int)toSplit.multi.size(), 0.),
+	  count(0), multi(toSplit.multi), step(toSplit.step) {}
+
+void Covariance::accumulate(const cv::Mat_<multi_img::Value> &block)
+{
+	if (block.rows == 0)
+		return;
+	cv::Mat_<double> tmp;
+	cv::mulTransposed(block, tmp, true, cv::noArray(), 1., CV_64F);
+	scatter += tmp;
+	cv::reduce(block, tmp, 0, CV_REDUCE_SUM, CV_64F);
+	sum += tmp;
+	count += block.rows;
+}
+
+void Covariance::operator()(const tbb::blocked_range<int> &r)
 {
-	for (size_t i = r.begin(); i != r.end(); ++i) {
-		cv::Mat_<multi_img::Value> input = source.col(i);
-		cv::Mat_<multi_img::Value> output(target.pixels[i], false);
-		pca.project(input, output);
+	const int D = (int)multi.size();
+	const int cols = (multi.width + step - 1) / step;
+	// gather pixels in blocks, so the products are not too small or large
+	const int blockRows = std::max(1, 4096 / cols);
+	cv::Mat_<multi_img::Value> block(blockRows * cols, D);
+
+	int filled = 0;
+	for (int i = r.begin(); i != r.end(); ++i) {
+		const int row = i * step;
+		for (int d = 0; d < D; ++d) {
+			const multi_img::Value *src = multi.bands[d][row];
+			for (int c = 0; c < cols; ++c)
+				block(filled + c, d) = src[c * step];
+		}
+		filled += cols;
+		if (filled == block.rows) {
+			accumulate(block);
+			filled = 0;
+		}
 	}
+	accumulate(block.rowRange(0, filled));
 }
 
+void Covariance::join(Covariance &toJoin)
+{
+	sum += toJoin.sum;
+	scatter += toJoin.scatter;
+	count += toJoin.count;
+}
 
-void MultiImg2BandMat::operator ()(const tbb::blocked_range<size_t> &r) const
+PcaProjection::PcaProjection(multi_img &source, multi_img &target,
+                             const cv::PCA &pca)
+	: source(source), target(target), pca(pca)
 {
-	for (size_t d = r.begin(); d != r.end(); ++d) {
-		multi_img::Band &src = source.bands[d];
-		multi_img::Band::const_iterator it; size_t i;
-		for (it = src.begin(), i = 0; it != src.end(); ++it, ++i)
-			target(d, i) = *it;
+	// (x - mean) * E^T = x * E^T - mean * E^T
+	cv::Mat_<multi_img::Value> mean = pca.mean.reshape(1, 1);
+	cv::gemm(mean, pca.eigenvectors, 1., cv::noArray(), 0., offset,
+	         cv::GEMM_2_T);
+}
+
+void PcaProjection::operator ()(const tbb::blocked_range<int> &r) const
+{
+	const int D = (int)source.size(), K = (int)target.size();
+	cv::Mat_<multi_img::Value> input(source.width, D);
+	for (int row = r.begin(); row != r.end(); ++row) {
+		for (int d = 0; d < D; ++d) {
+			const multi_img::Value *src = source.bands[d][row];
+			for (int col = 0; col < source.width; ++col)
+				input(col, d) = src[col];
+		}
+
+		// the cache row holds one projected pixel per matrix row
+		cv::Mat_<multi_img::Value> output(target.width, K,
+		                                  target.cachePtr(row, 0));
+		cv::gemm(input, pca.eigenvectors, 1., cv::noArray(), 0., output,
+		         cv::GEMM_2_T);
+		const multi_img::Value *o = offset[0];
+		for (int col = 0; col < target.width; ++col) {
+			multi_img::Value *dst = output[col];
+			for (int k = 0; k < K; ++k)
+				dst[k] -= o[k];
+		}
 	}
 }
 
 void Resize::operator()(const tbb::blocked_range2d<int> &r) const
 {
+	const size_t D = source.size(), N = target.size();
 	for (int row = r.rows().begin(); row != r.rows().end(); ++row) {
-		for (int col = r.cols().begin(); col != r.cols().end(); ++col) {
-			cv::Mat_<multi_img::Value> src(
-			            source.pixels[row * source.width + col], false);
-			cv::Mat_<multi_img::Value> dst(
-			            target.pixels[row * source.width + col], false);
-			cv::resize(src, dst, cv::Size(1, newsize));
-		}
+		const multi_img::Value *src = source.cachePtr(row, r.cols().begin());
+		multi_img::Value *dst = target.cachePtr(row, r.cols().begin());
+		for (int col = r.cols().begin(); col != r.cols().end();
+		     ++col, src += D, dst += N)
+			resampling.apply(src, dst);
 	}
 }
@@ -44,6 +44,27 @@ private:
 	multi_img::Value max;
 };
 
+/// accumulate multi_img::BandStatistics in a parallel reduction
+/** Range is over bands (rows of r) and image rows (cols of r). **/
+class DetermineStatistics {
+public:
+	DetermineStatistics(multi_img &multi);
+	DetermineStatistics(DetermineStatistics &toSplit, tbb::split);
+	void operator()(const tbb::blocked_range2d<int> &r);
+	void join(DetermineStatistics &toJoin);
+	/// final statistics after the reduction
+	multi_img::BandStatistics result() const;
+private:
+	void init();
+	multi_img &multi;
+	std::vector<multi_img::Range> range;
+	std::vector<double> sum;
+	cv::Mat_<int> hist;
+	multi_img::Range histRange;
+	/// bins per value unit
+	double binScale;
+};
+
 // TODO doc
 class Xyz {
 public:
@@ -70,40 +91,56 @@ private:
 	float greensum;
 };
 
-// TODO doc
-class Grad {
+/// fused XYZ accumulation and sRGB conversion over tiles of pixels
+/** All bands are accumulated for a tile at once, with per-band CIE weights
+	folded with 1/maxval and the green normalization, so no intermediate
+	XYZ image is needed. **/
+class XyzBgr {
 public:
-	Grad(multi_img &source, multi_img &target)
-		: source(source), target(target) {}
-	void operator()(const tbb::blocked_range<size_t> &r) const;
+	XyzBgr(const std::vector<multi_img::Band> &bands,
+	       const std::vector<multi_img::BandDesc> &meta,
+	       multi_img::Value maxval, cv::Mat_<cv::Vec3f> &bgr);
+	void operator()(const tbb::blocked_range2d<int> &r) const;
+
+	// number of pixels per row accumulated at once
+	static const int TILE = 256;
 
 private:
-	multi_img &source;
-	multi_img &target;
+	std::vector<const multi_img::Band*> bands;
+	std::vector<cv::Vec3f> weights;
+	cv::Mat_<cv::Vec3f> &bgr;
 };
 
-// TODO doc
-class Log {
+/// spectral gradient of the clamped logarithm of source into target bands
+/** target band i receives max(log(x_{i+1}), 0) - max(log(x_i), 0). The log
+	of each band is computed once per tile and reused for both neighbours. **/
+class LogGrad {
 public:
-	Log(multi_img &source, multi_img &target)
+	LogGrad(multi_img &source, multi_img &target)
 		: source(source), target(target) {}
-	void operator()(const tbb::blocked_range<size_t> &r) const;
+	void operator()(const tbb::blocked_range2d<int> &r) const;
+
+	// number of pixels per row processed at once
+	static const int TILE = 256;
 
 private:
 	multi_img &source;
 	multi_img &target;
 };
 
-// TODO doc
+/// normalize pixels of source to unit L2 norm into target's pixel cache
+/** With writeBands, the band data of target is written as well, so no
+	ApplyCache pass is needed afterwards. **/
 class NormL2 {
 public:
-	NormL2(multi_img &source, multi_img &target)
-		: source(source), target(target) {}
+	NormL2(multi_img &source, multi_img &target, bool writeBands = false)
+		: source(source), target(target), writeBands(writeBands) {}
 	void operator()(const tbb::blocked_range2d<int> &r) const;
 
 private:
 	multi_img &source;
 	multi_img &target;
+	bool writeBands;
 };
 
 // TODO doc
@@ -129,37 +166,52 @@ private:
 	bool remove;
 };
 
-class PcaProjection {
+/// accumulate sum and scatter matrix of pixels for PCA
+/** Only every step-th pixel in each direction is taken into account.
+	Range is over sampled rows (row = index * step). **/
+class Covariance {
 public:
-	PcaProjection(cv::Mat_<multi_img::Value> &source, multi_img &target, cv::PCA &pca)
-		: source(source), target(target), pca(pca) {}
-	void operator()(const tbb::blocked_range<size_t> &r) const;
+	Covariance(multi_img &multi, int step);
+	Covariance(Covariance &toSplit, tbb::split);
+	void operator()(const tbb::blocked_range<int> &r);
+	void join(Covariance &toJoin);
+
+	/// number of rows for the blocked_range
+	static int sampledRows(const multi_img &multi, int step)
+	{ return (multi.height + step - 1) / step; }
+
+	cv::Mat_<double> sum, scatter;
+	size_t count;
 private:
-	cv::Mat_<multi_img::Value> &source;
-	multi_img &target;
-	cv::PCA &pca;
+	void accumulate(const cv::Mat_<multi_img::Value> &block);
+	multi_img &multi;
+	int step;
 };
 
-
-class MultiImg2BandMat {
+/// project pixels of source (band data) into target's pixel cache
+/** Range is over rows. Each row is transformed with one matrix product. **/
+class PcaProjection {
 public:
-	MultiImg2BandMat(multi_img &source, cv::Mat_<multi_img::Value> &target)
-		: source(source), target(target) {}
-	void operator()(const tbb::blocked_range<size_t> &r) const;
+	PcaProjection(multi_img &source, multi_img &target, const cv::PCA &pca);
+	void operator()(const tbb::blocked_range<int> &r) const;
 private:
 	multi_img &source;
-	cv::Mat_<multi_img::Value> &target;
+	multi_img &target;
+	const cv::PCA &pca;
+	/// projected mean, subtracted from every result
+	cv::Mat_<multi_img::Value> offset;
 };
 
 class Resize {
 public:
-	Resize(multi_img &source, multi_img &target, size_t newsize)
-		: source(source), target(target), newsize(newsize) {}
+	Resize(multi_img &source, multi_img &target,
+	       const multi_img::Resampling &resampling)
+		: source(source), target(target), resampling(resampling) {}
 	void operator()(const tbb::blocked_range2d<int> &r) const;
 private:
 	multi_img &source;
 	multi_img &target;
-	size_t newsize;
+	const multi_img::Resampling &resampling;
 };
 
 #endif // MULTI_IMG_TBB_H
@@ -0,0 +1,152 @@
+#include "multi_img_tiled.h"
+#include "illuminant.h"
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <algorithm>
+#include <iostream>
+
+const size_t multi_img_tiled::BUDGET;
+
+bool multi_img_memory_sink::begin(int width, int height, const multi_img &first)
+{
+	target = multi_img(height, width, first.size());
+	target.minval = first.minval;
+	target.maxval = first.maxval;
+	target.meta = first.meta;
+	return true;
+}
+
+bool multi_img_memory_sink::put(int row, const multi_img &stripe)
+{
+	assert(stripe.size() == target.size());
+	// observed ranges may differ between stripes, e.g. for projections
+	target.minval = std::min(target.minval, stripe.minval);
+	target.maxval = std::max(target.maxval, stripe.maxval);
+	for (size_t d = 0; d < target.size(); ++d) {
+		multi_img::Band dst = target.bands[d].rowRange(row, row + stripe.height);
+		stripe.bands[d].copyTo(dst);
+	}
+	return true;
+}
+
+bool multi_img_memory_sink::end()
+{
+	// cache became invalid
+	target.resetPixels();
+	return true;
+}
+
+bool multi_img_cube_sink::begin(int w, int h, const multi_img &first)
+{
+	out.open(filename.c_str(), std::ios::out | std::ios::binary);
+	if (out.fail()) {
+		std::cerr << "Writing failed! Could not open " << filename << std::endl;
+		return false;
+	}
+	width = w;
+	height = h;
+	range = multi_img::Range(first.minval, first.maxval);
+	meta = first.meta;
+	offset = multi_img::write_cube_header(out, width, height,
+	                                      range.min, range.max, meta);
+	return !out.fail();
+}
+
+bool multi_img_cube_sink::put(int row, const multi_img &stripe)
+{
+	range.min = std::min(range.min, stripe.minval);
+	range.max = std::max(range.max, stripe.maxval);
+
+	// band sequential: each band of the stripe goes to its own place
+	const std::streamsize rowsize = (std::streamsize)width*sizeof(multi_img::Value);
+	for (size_t d = 0; d < stripe.size(); ++d) {
+		out.seekp(offset + ((unsigned long long)d*height + row) * rowsize);
+		multi_img::Band band;
+		stripe.getBand(d, band);
+		for (int y = 0; y < stripe.height; ++y)
+			out.write((const char*)band[y], rowsize);
+	}
+	return !out.fail();
+}
+
+bool multi_img_cube_sink::end()
+{
+	// header again with the range of all stripes, its size is unchanged
+	out.seekp(0);
+	multi_img::write_cube_header(out, width, height, range.min, range.max,
+	                             meta);
+	out.close();
+	if (out.fail()) {
+		std::cerr << "Writing failed! Error writing to " << filename
+		          << std::endl;
+		return false;
+	}
+	return true;
+}
+
+int multi_img_tiled::stripeRows() const
+{
+	if (source.width == 0 || source.size() == 0)
+		return std::max(source.height, 1);
+
+	/* source stripe and result stripe with their pixel caches. the result
+	   is assumed to have at most the size of the source */
+	const size_t row = 4 * source.width * source.size()
+	                   * sizeof(multi_img::Value);
+	int rows = (int)std::max<size_t>(budget / row, 1);
+	// align to cache tiles if possible
+	if (rows > multi_img::CACHE_TILE)
+		rows -= rows % multi_img::CACHE_TILE;
+	return std::min(rows, source.height);
+}
+
+bool multi_img_tiled::run(const Operation &op, multi_img_sink &sink,
+                          ProgressObserver *po) const
+{
+	const int rows = stripeRows();
+	for (int y = 0; y < source.height; y += rows) {
+		if (po && po->isAborted())
+			return false;
+
+		const cv::Rect area(0, y, source.width,
+		                    std::min(rows, source.height - y));
+		multi_img stripe(source, area);
+		op(stripe);
+
+		if (y == 0 && !sink.begin(source.width, source.height, stripe))
+			return false;
+		if (!sink.put(y, stripe))
+			return false;
+
+		if (po && !po->update((float)(y + area.height) / source.height))
+			return false;
+	}
+	return sink.end();
+}
+
+multi_img_tiled::Operation multi_img_tiled::normalize()
+{
+	return [](multi_img &img) { img.normalize_magnitudes(); };
+}
+
+multi_img_tiled::Operation multi_img_tiled::gradient()
+{
+	return [](multi_img &img) { img = img.log_gradient(); };
+}
+
+multi_img_tiled::Operation multi_img_tiled::clamp()
+{
+	return [](multi_img &img) { img.clamp(); };
+}
+
+multi_img_tiled::Operation multi_img_tiled::illuminant(const Illuminant &il,
+                                                       bool remove)
+{
+	return [il, remove](multi_img &img) { img.apply_illuminant(il, remove); };
+}
+
+multi_img_tiled::Operation multi_img_tiled::projection(const cv::PCA &pca)
+{
+	return [pca](multi_img &img) { img = img.project(pca); };
+}
@@ -0,0 +1,111 @@
+#ifndef MULTI_IMG_TILED_H
+#define MULTI_IMG_TILED_H
+
+#include <multi_img.h>
+#include <progress_observer.h>
+#include <fstream>
+#include <functional>
+
+class Illuminant;
+
+/// receives the result of a tiled operation, stripe by stripe
+class multi_img_sink {
+public:
+	virtual ~multi_img_sink() {}
+
+	/// prepare for a result of given size, bands and range as in first
+	virtual bool begin(int width, int height, const multi_img &first) = 0;
+
+	/// store a stripe of the result, starting at given image row
+	virtual bool put(int row, const multi_img &stripe) = 0;
+
+	/// finish after the last stripe
+	virtual bool end() { return true; }
+};
+
+/// assembles the result in an in-memory image
+class multi_img_memory_sink : public multi_img_sink {
+public:
+	multi_img_memory_sink(multi_img &target) : target(target) {}
+	virtual bool begin(int width, int height, const multi_img &first);
+	virtual bool put(int row, const multi_img &stripe);
+	virtual bool end();
+
+protected:
+	multi_img &target;
+};
+
+/// writes the result into a native cube file (see multi_img::write_cube())
+class multi_img_cube_sink : public multi_img_sink {
+public:
+	multi_img_cube_sink(const std::string &filename) : filename(filename) {}
+	virtual bool begin(int width, int height, const multi_img &first);
+	virtual bool put(int row, const multi_img &stripe);
+	virtual bool end();
+
+protected:
+	std::string filename;
+	std::ofstream out;
+	unsigned long long offset;
+	int width, height;
+	/// value range over all stripes, written to the header in the end
+	multi_img::Range range;
+	std::vector<multi_img::BandDesc> meta;
+};
+
+/// runs per-pixel operations on a multi_img_base with bounded memory
+/**
+	The source is processed in stripes of full image rows. Each stripe is
+	read via multi_img_base::getBandRegion() into a multi_img, the operation
+	is applied, and the result is handed to a sink. The stripe height is
+	chosen so that source stripe, result stripe and their pixel caches fit
+	into the memory budget. With an offloaded or memory-mapped source and a
+	file sink, images of any size can be processed.
+
+	Operations must only combine values of the same pixel (e.g. no spatial
+	filtering), and yield the same bands for every stripe. Besides the
+	operations below, any function on a multi_img can be used, e.g. SOM
+	lookup via som::GenSOM::quantize().
+
+	ImgInput uses it to preprocess a native cube file into another one
+	(writeCube option), without loading the source.
+  */
+class multi_img_tiled {
+public:
+	/// operation on a stripe of the image, may replace it by its result
+	typedef std::function<void (multi_img &)> Operation;
+
+	/// default memory budget
+	static const size_t BUDGET = 512 * 1048576;
+
+	multi_img_tiled(const multi_img_base &source, size_t budget = BUDGET)
+		: source(source), budget(budget) {}
+
+	/// number of image rows processed at once
+	int stripeRows() const;
+
+	/// apply op to all stripes and hand the results to sink
+	/** @return false if the sink failed or the computation was aborted **/
+	bool run(const Operation &op, multi_img_sink &sink,
+	         ProgressObserver *po = 0) const;
+
+/** @name Operations **/
+//@{
+	/// normalize pixels to unit L2 length
+	static Operation normalize();
+	/// spectral gradient of the logarithm, as GradientTbb
+	static Operation gradient();
+	/// clamp data to the theoretical value range
+	static Operation clamp();
+	/// apply or remove an illuminant
+	static Operation illuminant(const Illuminant &il, bool remove);
+	/// project into a precomputed PCA space
+	static Operation projection(const cv::PCA &pca);
+//@}
+
+protected:
+	const multi_img_base &source;
+	size_t budget;
+};
+
+#endif // MULTI_IMG_TILED_H
@@ -52,6 +52,8 @@ Controller::Controller(const QString &filename,
 	// create gui (perform initUI before connecting signals!)
 	window = new MainWindow();
 	window->initUI(filename);
+	connect(im, SIGNAL(loadProgress(int)),
+	        window, SLOT(showLoadProgress(int)));
 
 	// initialize models
 	initImage();
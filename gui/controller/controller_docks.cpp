@@ -186,6 +186,8 @@ void Controller::setupDocks()
 	// model to dock (reset handled in RoiDock)
 	connect(imageModel(), SIGNAL(fullRgbUpdate(QPixmap)),
 			roiDock, SLOT(updatePixmap(QPixmap)));
+	connect(roiDock, SIGNAL(viewScaleChanged(double)),
+			imageModel(), SLOT(setOverviewScale(double)));
 
 	connect(imageModel(), SIGNAL(roiRectChanged(cv::Rect)),
 			roiDock, SLOT(setRoi(cv::Rect)));
@@ -81,6 +81,12 @@ bool DistviewBinsTbb::run()
 		updateContext();
 
 	std::vector<cv::Rect>::iterator it;
+	// dirty tiles must not be rebuilt concurrently inside Accumulate
+	for (it = sub.begin(); it != sub.end(); ++it)
+		(*multi)->rebuildPixels(*it);
+	for (it = add.begin(); it != add.end(); ++it)
+		(*multi)->rebuildPixels(*it);
+
 	/* substract pixels from bins */
 	for (it = sub.begin(); it != sub.end(); ++it) {
 		Accumulate substract(true, **multi, labels, mask, args.nbins,
@@ -154,7 +160,7 @@ void Accumulate::operator()(const tbb::blocked_range2d<int> &r) const
 
 			int label = (ignoreLabels ? 0 : lr[x]);
 			label = (label >= (int)sets.size()) ? 0 : label;
-			const multi_img::Pixel& pixel = multi(y, x);
+			multi_img::PixelView pixel = multi(y, x);
 			BinSet &s = sets[label];
 
 			BinSet::HashKey hashkey(multi.size());
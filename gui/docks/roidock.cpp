@@ -14,7 +14,7 @@ static QRect CVRect2QRect(const cv::Rect &r) {
 }
 
 RoiDock::RoiDock(QWidget *parent) :
-	QDockWidget(parent)
+	QDockWidget(parent), pixmapWidth(0)
 {
 	setObjectName("ROIDock");
 	setupUi(this);
@@ -57,6 +57,8 @@ void RoiDock::initUi()
 	view->setScene(roiView);
 	connect(roiView, SIGNAL(newContentRect(QRect)),
 			view, SLOT(fitContentRect(QRect)));
+	connect(roiView, SIGNAL(newContentRect(QRect)),
+			this, SLOT(processContentRect(QRect)));
 
 	// initialize button row
 	btn = new AutohideWidget();
@@ -134,11 +136,19 @@ void RoiDock::resetRoi()
 
 void RoiDock::updatePixmap(const QPixmap image)
 {
+	// set before, the view reports its new geometry right away
+	pixmapWidth = image.width();
 	roiView->setPixmap(image);
 	//GGDBGM(format("pixmap size %1%x%2%")%image.width() %image.height()<<endl);
 	roiView->update();
 }
 
+void RoiDock::processContentRect(const QRect &rect)
+{
+	if (pixmapWidth > 0)
+		emit viewScaleChanged(rect.width() / (double)pixmapWidth);
+}
+
 void RoiDock::enableActions(bool enable)
 {
 	uibtn->actionApply->setEnabled(enable);
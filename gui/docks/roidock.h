@@ -28,6 +28,9 @@ signals:
 	/** User has requested a new binning by adjusting bands slider */
 	void specRescaleRequested(int bands);
 
+	/** The pixmap is displayed at scale (display size / pixmap size). */
+	void viewScaleChanged(double scale);
+
 public slots:
 	/** Update the pixmap displayed in the ROI-View. */
 	void updatePixmap(const QPixmap image);
@@ -43,6 +46,9 @@ protected slots:
 	// new roi selected in RoiView or propagated through controller (internal)
 	void processNewSelection(const QRect &roi, bool internal = false);
 
+	// new geometry of the pixmap in RoiView
+	void processContentRect(const QRect &rect);
+
 	// helper functions to roiButtonsClicked
 	void resetRoi();
 	void applyRoi();
@@ -57,6 +63,8 @@ private:
 	QRect oldRoi;
 	// The current ROI selected, but possibly not yet applied.
 	QRect curRoi;
+	// width of the pixmap displayed
+	int pixmapWidth;
 
 	// our viewport (a scene actually)
 	ROIView *roiView;
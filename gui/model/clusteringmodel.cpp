@@ -171,7 +171,7 @@ void ClusteringModel::startSegmentation()
 			this,
 			SLOT(processSegmentationFailed()));
 
-	// create copies of the input image images
+	// create copies of the input image images (copy-on-write, no data copied)
 	{
 		// Meanshift always needs the IMG/NORM representation for SUPERPIXEL.
 		SharedMultiImgBaseGuard guard(*inputMap[representation::NORM]);
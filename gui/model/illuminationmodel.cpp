@@ -96,10 +96,12 @@ void IllumModel::buildIllum(int t)
 	QVector<multi_img::Value> cf;
 	if (t > 0) {
 		SharedMultiImgBaseGuard guard(*image);
-		il.setNormalization((*image)->meta[0].center,
-					  (*image)->meta[(*image)->size()-1].center);
+		// the image may not be in memory yet, see ImageModel::loadImage()
+		const multi_img_base &img = image->getBase();
+		il.setNormalization(img.meta[0].center,
+					  img.meta[img.size()-1].center);
 		cf = QVector<multi_img::Value>::fromStdVector(
-					(*image)->getIllumCoeff(il));
+					img.getIllumCoeff(il));
 	}
 	// else: cf is empty vector
 
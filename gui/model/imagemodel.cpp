@@ -13,16 +13,24 @@
 #include <background_task/tasks/tbb/band2qimagetbb.h>
 #include <background_task/tasks/tbb/datarangetbb.h>
 #include <background_task/tasks/tbb/gradienttbb.h>
+#include <background_task/tasks/tbb/loadtbb.h>
 #include <background_task/tasks/tbb/norml2tbb.h>
 #include <background_task/tasks/tbb/normrangetbb.h>
 #include <background_task/tasks/tbb/pcatbb.h>
+#include <background_task/tasks/tbb/previewtbb.h>
+#include <background_task/tasks/tbb/pyramidtbb.h>
 #include <background_task/tasks/tbb/rescaletbb.h>
 #include <background_task/tasks/tbb/rgbqttbb.h>
 
 #include <multi_img/multi_img_offloaded.h>
+#include <multi_img/multi_img_packed.h>
+#include <multi_img/multi_img_pyramid.h>
+#include <derived_cache.h>
 #include <imginput.h>
 
 #include <boost/make_shared.hpp>
+#include <algorithm>
+#include <sstream>
 
 #ifdef GERBIL_CUDA
 	#include <opencv2/gpu/gpu.hpp>
@@ -34,6 +42,8 @@
 ImageModel::ImageModel(BackgroundTaskQueue &queue, bool lm, QObject *parent)
 	: QObject(parent), limitedMode(lm), queue(queue),
 	  image_lim(new SharedMultiImgBase(new multi_img())),
+	  fullRgbShown(false), fullRgbLevel(0), overviewScale(0.),
+	  loadShown(0),
 	  nBands(0), nBandsOld(0)
 {
 	for (auto r : representation::all()) {
@@ -80,12 +90,35 @@ cv::Rect ImageModel::loadImage(const QString &filename)
 {
 	// do a more complicated transformation to preserve non-ascii filenames
 	std::string fn = filename.toLocal8Bit().constData();
-	if (limitedMode) {
+	std::pair<std::vector<std::string>, std::vector<multi_img::BandDesc> >
+			filelist;
+	// true if the image is mapped and read into memory in the background
+	bool loading = false;
+	if (limitedMode)
+		filelist = multi_img::parse_filelist(fn);
+	if (limitedMode && !filelist.first.empty()) {
 		// create offloaded image
-		std::pair<std::vector<std::string>, std::vector<multi_img::BandDesc> >
-				filelist = multi_img::parse_filelist(fn);
 		image_lim = boost::make_shared<SharedMultiImgBase>
 				(new multi_img_offloaded(filelist.first, filelist.second));
+	} else if (limitedMode) {
+		// single file: keep it in memory, but with 16 bit per sample
+		if (multi_img_base *mapped = imginput::ImgInput::open(fn)) {
+			// packed band-wise from the file, its range is not known yet
+			image_lim = boost::make_shared<SharedMultiImgBase>
+					(new multi_img_packed(*mapped, multi_img_packed::UINT16,
+					                      true));
+			delete mapped;
+		} else {
+			imginput::ImgInputConfig inputConfig;
+			inputConfig.file = fn;
+			multi_img::ptr img = imginput::ImgInput(inputConfig).execute();
+			image_lim = boost::make_shared<SharedMultiImgBase>
+					(new multi_img_packed(*img));
+		}
+	} else if (multi_img_base *mapped = imginput::ImgInput::open(fn)) {
+		// raw formats are mapped right away and read in the background
+		image_lim = boost::make_shared<SharedMultiImgBase>(mapped);
+		loading = true;
 	} else {
 		// create using ImgInput
 		imginput::ImgInputConfig inputConfig;
@@ -106,9 +139,60 @@ cv::Rect ImageModel::loadImage(const QString &filename)
 		                             "(channels).");
 		return cv::Rect();
 	} else {
-		// Update recent files list.
-		QPixmap pvpm = fullRgb();
-		RecentFile::appendToRecentFilesList(filename, pvpm);
+		/* the full resolution RGB is computed in the background, see
+		 * computeFullRgb(). Until then, a subsampled one does, which is
+		 * computed first thing in the background, too. */
+		this->filename = filename;
+		preview = QPixmap();
+		fullRgbShown = false;
+		fullRgbLevel = 0;
+		overviewScale = 0.;
+		loadShown = 0;
+		previewSmall = SharedMultiImgPtr(
+		            new SharedMultiImgBase(new multi_img()));
+		if (loading) {
+			/* the preview is filled along with the image, shown in between
+			 * by processLoadProgress() */
+			BackgroundTaskPtr taskLoad(
+			            new LoadTbb(image_lim, previewSmall, 512));
+			QObject::connect(taskLoad.get(), SIGNAL(progressChanged(int)),
+			                 this, SLOT(processLoadProgress(int)),
+			                 Qt::QueuedConnection);
+			queue.push(taskLoad);
+		} else {
+			BackgroundTaskPtr taskSmall(
+			            new PreviewTbb(image_lim, previewSmall, 512));
+			queue.push(taskSmall);
+		}
+		previewImg = qimage_ptr(new SharedData<QImage>(NULL));
+		BackgroundTaskPtr taskPreview(new RgbTbb(
+			previewSmall,
+			mat3f_ptr(new SharedData<cv::Mat3f>(new cv::Mat3f)),
+			previewImg));
+		QObject::connect(taskPreview.get(), SIGNAL(finished(bool)),
+		                 this, SLOT(processPreviewFinished(bool)),
+		                 Qt::QueuedConnection);
+		queue.push(taskPreview);
+
+		/* overview levels are built first thing in the background. Each is
+		 * an in-memory multi_img, which limited mode cannot afford. */
+		pyramid.clear();
+		if (!limitedMode) {
+			size_t levels = multi_img_pyramid::levelCount(
+			            cv::Size(i.width, i.height));
+			for (size_t l = 1; l < levels; ++l)
+				pyramid.push_back(SharedMultiImgPtr(
+				                new SharedMultiImgBase(new multi_img())));
+			BackgroundTaskPtr taskPyramid(new PyramidTbb(image_lim, pyramid));
+			queue.push(taskPyramid);
+		}
+
+		// the full RGB only depends on the input file, reuse it across runs
+		fullRgbInput.clear();
+		if (DerivedCache().enabled())
+			fullRgbInput = DerivedCache::inputFingerprint(
+			            imginput::ImgInput::inputFiles(fn));
+
 		return cv::Rect(0, 0, i.width, i.height);
 	}
 }
@@ -239,8 +323,9 @@ void ImageModel::spawn(representation::t type, const cv::Rect &newROI, int bands
 
 	// IMGPCA / GRADPCA
     if (type == representation::IMGPCA && imagepca.get()) {
+		// covariance from a subsample is plenty for display purposes
 		BackgroundTaskPtr taskPca(new PcaTbb(
-			image, imagepca, 10));
+			image, imagepca, 10, true, 1 << 18, true));
 		queue.push(taskPca);
 /*	} else if (type == representation::GRADPCA && gradpca.get()) {
 		BackgroundTaskPtr taskPca(new PcaTbb(
@@ -312,7 +397,144 @@ void ImageModel::computeBand(representation::t type, int dim)
 
 void ImageModel::computeFullRgb()
 {
-	emit fullRgbUpdate(fullRgb());
+	cv::Rect dims = getFullImageRect();
+	fullRgbLevel = 0; // no recomputation for scales reported meanwhile
+
+	/* show something right away, in the size of the full image. The ROI view
+	 * reports its scale in turn, see setOverviewScale(). */
+	if (!preview.isNull() && !fullRgbShown) {
+		emit fullRgbUpdate(preview.scaled(dims.width, dims.height,
+		                                  Qt::IgnoreAspectRatio,
+		                                  Qt::FastTransformation));
+	}
+
+	// until the view has a scale, assume a screen's worth of pixels
+	double scale = overviewScale;
+	if (scale <= 0.)
+		scale = 2048. / std::max(dims.width, dims.height);
+	fullRgbLevel = multi_img_pyramid::choose(scale, pyramid.size() + 1);
+
+	fullRgbKey = DerivedCache::Key();
+	if (!fullRgbInput.empty()) {
+		std::stringstream params;
+		params << "fullrgb level " << fullRgbLevel;
+		fullRgbKey = DerivedCache::key(fullRgbInput, params.str());
+	}
+
+	DerivedCache cache;
+	if (!fullRgbKey.empty() && cache.contains(fullRgbKey, "png")) {
+		QPixmap p(QString::fromLocal8Bit(cache.path(fullRgbKey, "png").c_str()));
+		if (!p.isNull()) {
+			fullRgbImg.reset(); // outdates pending tasks
+			fullRgbShown = true;
+			emit fullRgbUpdate(p.scaled(dims.width, dims.height,
+			                            Qt::IgnoreAspectRatio,
+			                            Qt::SmoothTransformation));
+			return;
+		}
+	}
+
+	SharedMultiImgPtr source = image_lim;
+	if (fullRgbLevel > 0) {
+		/* the pyramid task may have been cancelled, leaving levels empty.
+		 * Pushing it again fills in what is missing, if anything. */
+		std::vector<SharedMultiImgPtr> levels(pyramid.begin(),
+		                                      pyramid.begin() + fullRgbLevel);
+		BackgroundTaskPtr taskPyramid(new PyramidTbb(image_lim, levels));
+		queue.push(taskPyramid);
+		source = levels.back();
+	}
+
+	fullRgbImg = qimage_ptr(new SharedData<QImage>(NULL));
+	BackgroundTaskPtr taskRgb(new RgbTbb(
+		source, mat3f_ptr(new SharedData<cv::Mat3f>(new cv::Mat3f)),
+		fullRgbImg));
+	QObject::connect(taskRgb.get(), SIGNAL(finished(bool)),
+	                 this, SLOT(processFullRgbFinished(bool)),
+	                 Qt::QueuedConnection);
+	queue.push(taskRgb);
+}
+
+void ImageModel::processFullRgbFinished(bool success)
+{
+	if (!success || !fullRgbImg)
+		return;
+	SharedDataLock lock(fullRgbImg->mutex);
+	// a newer task for a finer level may have replaced fullRgbImg meanwhile
+	if (fullRgbImg->operator->() == NULL)
+		return;
+	QPixmap p = QPixmap::fromImage(**fullRgbImg);
+	lock.unlock();
+
+	DerivedCache cache;
+	if (!fullRgbKey.empty() && cache.enabled()) {
+		std::string tmp = cache.tempPath(fullRgbKey, "png");
+		if (p.save(QString::fromLocal8Bit(tmp.c_str()), "PNG"))
+			cache.commit(fullRgbKey, "png");
+	}
+
+	// computed from an overview level, views expect full image coordinates
+	cv::Rect dims = getFullImageRect();
+	if (p.width() != dims.width || p.height() != dims.height)
+		p = p.scaled(dims.width, dims.height, Qt::IgnoreAspectRatio,
+		             Qt::SmoothTransformation);
+	fullRgbShown = true;
+	emit fullRgbUpdate(p);
+}
+
+void ImageModel::processLoadProgress(int percent)
+{
+	emit loadProgress(percent);
+
+	// the preview task takes over at the end
+	if (percent >= 100 || percent < loadShown + 20 || fullRgbShown)
+		return;
+	loadShown = percent;
+
+	// rows read so far, the rest is blank
+	qimage_ptr partial(new SharedData<QImage>(NULL));
+	SharedDataLock lock(previewSmall->mutex);
+	if (previewSmall->getBase().empty())
+		return;
+	BackgroundTaskPtr taskRgb(new RgbTbb(
+		previewSmall, mat3f_ptr(new SharedData<cv::Mat3f>(new cv::Mat3f)),
+		partial));
+	bool success = taskRgb->run();
+	lock.unlock();
+	if (!success || !partial->operator->())
+		return;
+
+	cv::Rect dims = getFullImageRect();
+	emit fullRgbUpdate(QPixmap::fromImage(**partial).scaled(
+	                       dims.width, dims.height, Qt::IgnoreAspectRatio,
+	                       Qt::FastTransformation));
+}
+
+void ImageModel::processPreviewFinished(bool success)
+{
+	if (success && previewImg) {
+		SharedDataLock lock(previewImg->mutex);
+		preview = QPixmap::fromImage(**previewImg);
+	}
+	// Update recent files list.
+	RecentFile::appendToRecentFilesList(filename, preview);
+
+	if (preview.isNull() || fullRgbShown)
+		return;
+	cv::Rect dims = getFullImageRect();
+	emit fullRgbUpdate(preview.scaled(dims.width, dims.height,
+	                                  Qt::IgnoreAspectRatio,
+	                                  Qt::FastTransformation));
+}
+
+void ImageModel::setOverviewScale(double scale)
+{
+	overviewScale = scale;
+
+	// recompute only if the view now shows more than the level provides
+	size_t level = multi_img_pyramid::choose(scale, pyramid.size() + 1);
+	if (level < fullRgbLevel)
+		computeFullRgb();
 }
 
 void ImageModel::setNormalizationParameters(representation::t type,
@@ -349,18 +571,3 @@ void ImageModel::processNewImageData(representation::t type,
 	emit imageUpdate(type, image, /* duplicate */ false);
 }
 
-QPixmap ImageModel::fullRgb()
-{
-	// FIXME Caching
-
-	qimage_ptr fullRgb(new SharedData<QImage>(NULL));
-	/* we do it instantly as this is typically what the user wants to see first,
-	 * and not wait for it while the queue processes other things */
-	BackgroundTaskPtr taskRgb(new RgbTbb(
-		image_lim, mat3f_ptr(new SharedData<cv::Mat3f>(new cv::Mat3f)),
-								  fullRgb));
-	taskRgb->run();
-
-	QPixmap p = QPixmap::fromImage(**fullRgb);
-	return p;
-}
@@ -3,11 +3,13 @@
 
 #include <model/representation.h>
 #include <shared_data.h>
+#include <derived_cache.h>
 #include <background_task/background_task_queue.h>
 
 #include <QObject>
 #include <QMap>
 #include <QPixmap>
+#include <string>
 #include <vector>
 
 class ImageModelPayload : public QObject {
@@ -125,13 +127,22 @@ public slots:
 	void computeBand(representation::t type, int dim);
 	/** Compute rgb representation of full image.
 	 *
-	 * Emits fullRgbUpdate() when finished.
+	 * Emits fullRgbUpdate() right away with the preview if it is ready (else
+	 * once it is), and again with full resolution when the background task
+	 * has finished.
 	 *
 	 * @note Typically this is called only once upon loading, since the RGB
 	 * representation for ROI-View does not need to be updated.
 	 */
 	void computeFullRgb();
 
+	/** The ROI view shows the full image at scale (display size / image size).
+	 *
+	 * The full resolution RGB is computed from the coarsest overview that
+	 * suffices for this scale, and recomputed when the view needs more.
+	 */
+	void setOverviewScale(double scale);
+
 	void setNormalizationParameters(
 			representation::t type,
 			multi_img::NormMode normMode,
@@ -150,6 +161,11 @@ signals:
 
 	void fullRgbUpdate(QPixmap fullRgb);
 
+	/** The input image is read into memory in the background, percent of it
+	 * is done. Reaches 100 when the image is complete. Not emitted for
+	 * formats that are read within loadImage(). */
+	void loadProgress(int percent);
+
 	/** The ROI image data for representation type has changed.
 	 *
 	 * This signal is emitted whenever the ROI is set to a new rect or the
@@ -196,10 +212,16 @@ protected slots:
 	// payload background task has finished
 	void processNewImageData(representation::t type, SharedMultiImgPtr image);
 
-private:
+	// background reading of the input image has progressed
+	void processLoadProgress(int percent);
 
-	// Computes RGB image of full image (ignoring ROI).
-	QPixmap fullRgb();
+	// preview RGB background task has finished
+	void processPreviewFinished(bool success);
+
+	// full resolution RGB background task has finished
+	void processFullRgbFinished(bool success);
+
+private:
 
 	// helper to spawn()
 	bool checkProfitable(const cv::Rect& oldROI, const cv::Rect& newROI);
@@ -207,6 +229,34 @@ private:
 	// FIXME rename
 	SharedMultiImgPtr image_lim; // big one
 
+	/* overview levels of image_lim, downsampled by 2, 4, 8, ... Only the
+	 * full RGB of the ROI view uses them. Band views, distribution views and
+	 * ROI scoping work on the ROI at full resolution. */
+	std::vector<SharedMultiImgPtr> pyramid;
+
+	// file name of image_lim, for the recent files list
+	QString filename;
+
+	// subsample of image_lim for the preview
+	SharedMultiImgPtr previewSmall;
+	// progress at which the preview was last shown during loading
+	int loadShown;
+
+	// quick, low resolution RGB of image_lim shown until fullRgbImg is ready
+	QPixmap preview;
+	qimage_ptr previewImg;
+	qimage_ptr fullRgbImg;
+	// true once the full resolution RGB was emitted, preview is obsolete then
+	bool fullRgbShown;
+	// pyramid level fullRgbImg is computed from, 0 for image_lim
+	size_t fullRgbLevel;
+	// scale of the ROI view, 0 if not known yet
+	double overviewScale;
+	// DerivedCache fingerprint of image_lim, empty if caching is disabled
+	std::string fullRgbInput;
+	// key of fullRgbImg in DerivedCache, empty if caching is disabled
+	DerivedCache::Key fullRgbKey;
+
 	// small ones (ROI) and their companion data:
 	QMap<representation::t, payload*> map;
 
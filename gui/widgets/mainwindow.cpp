@@ -22,6 +22,7 @@
 #include <QShortcut>
 #include <QFileInfo>
 #include <QMenu>
+#include <QStatusBar>
 #include <QSettings>
 
 #include <iostream>
@@ -120,6 +121,14 @@ void MainWindow::screenshot()
 	io.writeImage(output);
 }
 
+void MainWindow::showLoadProgress(int percent)
+{
+	if (percent < 100)
+		statusBar()->showMessage(QString("Loading image: %1%").arg(percent));
+	else
+		statusBar()->clearMessage();
+}
+
 void MainWindow::closeEvent(QCloseEvent *event)
 {
 	QSettings settings;
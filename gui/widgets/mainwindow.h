@@ -27,6 +27,9 @@ public slots:
 
 	void screenshot();
 
+	// progress of reading the image in the background, see ImageModel
+	void showLoadProgress(int percent);
+
 protected:
 
 	void closeEvent (QCloseEvent * event) override;
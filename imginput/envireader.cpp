@@ -0,0 +1,268 @@
+#include "imginput.h"
+#include "envireader.h"
+
+#include <multi_img_mapped.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace imginput {
+
+namespace {
+
+typedef std::map<std::string, std::string> Fields;
+
+std::string trim(const std::string &str)
+{
+	const char *ws = " \t\r\n";
+	std::string::size_type start = str.find_first_not_of(ws);
+	if (start == std::string::npos)
+		return std::string();
+	std::string::size_type end = str.find_last_not_of(ws);
+	return str.substr(start, end - start + 1);
+}
+
+std::string lower(std::string str)
+{
+	std::transform(str.begin(), str.end(), str.begin(), ::tolower);
+	return str;
+}
+
+bool endsWith(const std::string &str, const std::string &suffix)
+{
+	return str.size() >= suffix.size()
+	        && lower(str.substr(str.size() - suffix.size())) == suffix;
+}
+
+bool exists(const std::string &file)
+{
+	return std::ifstream(file.c_str()).good();
+}
+
+// read "key = value" pairs, values in braces may span several lines
+bool parseHeader(const std::string &file, Fields &fields)
+{
+	std::ifstream in(file.c_str());
+	std::string line;
+	if (!std::getline(in, line) || trim(line).compare(0, 4, "ENVI") != 0)
+		return false;
+
+	while (std::getline(in, line)) {
+		std::string::size_type eq = line.find('=');
+		if (eq == std::string::npos)
+			continue;
+		std::string key = lower(trim(line.substr(0, eq)));
+		std::string value = trim(line.substr(eq + 1));
+		if (!value.empty() && value[0] == '{') {
+			while (value.find('}') == std::string::npos
+			       && std::getline(in, line))
+				value += " " + line;
+			value = trim(value.substr(1, value.find('}') - 1));
+		}
+		fields[key] = value;
+	}
+	return true;
+}
+
+std::vector<float> parseList(std::string value)
+{
+	std::replace(value.begin(), value.end(), ',', ' ');
+	std::istringstream in(value);
+	std::vector<float> ret;
+	float v;
+	while (in >> v)
+		ret.push_back(v);
+	return ret;
+}
+
+int intField(const Fields &fields, const std::string &key, int def)
+{
+	Fields::const_iterator it = fields.find(key);
+	if (it == fields.end() || it->second.empty())
+		return def;
+	return atoi(it->second.c_str());
+}
+
+std::string field(const Fields &fields, const std::string &key)
+{
+	Fields::const_iterator it = fields.find(key);
+	return (it == fields.end() ? std::string() : lower(it->second));
+}
+
+}
+
+bool EnviReader::findFiles(const std::string &file,
+                           std::string &header, std::string &data)
+{
+	const char *exts[] = { "", ".raw", ".img", ".dat", ".bsq", ".bil", ".bip" };
+	const size_t nexts = sizeof(exts) / sizeof(exts[0]);
+
+	if (endsWith(file, ".hdr")) {
+		header = file;
+		const std::string base = file.substr(0, file.size() - 4);
+		for (size_t i = 0; i < nexts; ++i) {
+			data = base + exts[i];
+			if (exists(data))
+				return true;
+		}
+		return false;
+	}
+
+	data = file;
+	header = file + ".hdr";
+	if (exists(header))
+		return true;
+	std::string::size_type dot = file.find_last_of('.');
+	std::string::size_type slash = file.find_last_of("/\\");
+	if (dot == std::string::npos
+	    || (slash != std::string::npos && dot < slash))
+		return false;
+	header = file.substr(0, dot) + ".hdr";
+	return exists(header);
+}
+
+bool EnviReader::probe(const std::string &file)
+{
+	std::string header, data;
+	if (!findFiles(file, header, data))
+		return false;
+	std::ifstream in(header.c_str());
+	std::string line;
+	return std::getline(in, line) && trim(line).compare(0, 4, "ENVI") == 0;
+}
+
+multi_img_mapped* EnviReader::open(const std::string &file)
+{
+	std::string header, data;
+	Fields fields;
+	if (!findFiles(file, header, data) || !parseHeader(header, fields))
+		return NULL;
+
+	multi_img_mapped::Layout layout;
+	layout.width = intField(fields, "samples", 0);
+	layout.height = intField(fields, "lines", 0);
+	layout.bands = intField(fields, "bands", 0);
+	layout.offset = intField(fields, "header offset", 0);
+	layout.bigEndian = (intField(fields, "byte order", 0) == 1);
+	if (layout.width <= 0 || layout.height <= 0 || layout.bands == 0) {
+		std::cerr << "ENVI header " << header << " lacks image size."
+		          << std::endl;
+		return NULL;
+	}
+
+	const std::string interleave = field(fields, "interleave");
+	if (interleave == "bil")
+		layout.interleave = multi_img_mapped::BIL;
+	else if (interleave == "bip")
+		layout.interleave = multi_img_mapped::BIP;
+	else
+		layout.interleave = multi_img_mapped::BSQ;
+
+	switch (intField(fields, "data type", 0)) {
+	case 1:  layout.type = multi_img_mapped::UINT8;   break;
+	case 2:  layout.type = multi_img_mapped::INT16;   break;
+	case 4:  layout.type = multi_img_mapped::FLOAT32; break;
+	case 12: layout.type = multi_img_mapped::UINT16;  break;
+	default:
+		std::cerr << "ENVI data type of " << header << " is not supported."
+		          << std::endl;
+		return NULL;
+	}
+
+	/* keep data values: map the range to itself. It is the smallest range
+	   GdalReader assumes for the data type, see readFile() */
+	layout.srcmin = 0.f;
+	layout.srcmax = (layout.type == multi_img_mapped::FLOAT32 ? 1.f : 256.f);
+
+	// band descriptions, wavelengths may be given in micrometers
+	std::vector<multi_img::BandDesc> descs(layout.bands);
+	std::vector<float> centers = parseList(fields["wavelength"]);
+	std::vector<float> fwhm = parseList(fields["fwhm"]);
+	const std::string units = field(fields, "wavelength units");
+	const float factor = (units == "micrometers" || units == "microns"
+	                      || units == "um") ? 1000.f : 1.f;
+	if (centers.size() == layout.bands) {
+		for (size_t d = 0; d < descs.size(); ++d) {
+			float c = centers[d] * factor;
+			if (fwhm.size() == layout.bands && fwhm[d] > 0.f) {
+				float w = fwhm[d] * factor * 0.5f;
+				descs[d] = multi_img::BandDesc(c - w, c + w);
+			} else {
+				descs[d] = multi_img::BandDesc(c);
+			}
+		}
+	}
+
+	multi_img_mapped *mapped = new multi_img_mapped(data, layout, descs);
+	if (mapped->empty()) {
+		delete mapped;
+		return NULL;
+	}
+	mapped->minval = layout.srcmin;
+	mapped->maxval = layout.srcmax;
+
+	/* bands are not necessarily ordered by wavelength. Sort as GdalReader
+	   does, empty descriptions first, keeping the order of equal ones.
+	   Band selection refers to the sorted order. */
+	std::vector<size_t> order(descs.size());
+	for (size_t d = 0; d < order.size(); ++d)
+		order[d] = d;
+	std::stable_sort(order.begin(), order.end(),
+		[&descs](size_t a, size_t b) {
+			if (descs[b].empty)
+				return false;
+			if (descs[a].empty)
+				return true;
+			return descs[a].center < descs[b].center;
+		});
+	mapped->setBandOrder(order);
+	return mapped;
+}
+
+multi_img::ptr EnviReader::readFile()
+{
+	multi_img::ptr img_ptr(new multi_img());
+
+	// find ROI
+	cv::Rect roi;
+	std::vector<int> roiVals;
+	if (!config.roi.empty()) {
+		if (!ImgInput::parseROIString(config.roi, roiVals)) {
+			std::cerr << "Invalid ROI specification " << config.roi
+			          << std::endl;
+			return img_ptr;
+		}
+		roi = cv::Rect(roiVals[0], roiVals[1], roiVals[2], roiVals[3]);
+	}
+
+	multi_img_mapped *mapped = open(config.file);
+	if (!mapped)
+		return img_ptr;
+	// if bandhigh is not specified, do not limit
+	int bandhigh = (config.bandhigh == 0) ? -1 : config.bandhigh;
+
+	bool success = img_ptr->read_mapped(*mapped, roi, config.bandlow, bandhigh);
+	multi_img::Value powMax = mapped->maxval;
+	delete mapped;
+	if (!success)
+		return multi_img::ptr(new multi_img());
+
+	/* determine dynamic range of camera (we assume it is a power of two),
+	   as done in GdalReader */
+	multi_img::Range range = img_ptr->data_range();
+	for (; powMax < range.max; powMax *= 2) {
+		// nothing
+	}
+	img_ptr->minval = std::min(range.min, (multi_img::Value)0.f);
+	img_ptr->maxval = powMax;
+
+	return img_ptr;
+}
+
+} //namespace
@@ -0,0 +1,43 @@
+#ifndef ENVIREADER_H
+#define ENVIREADER_H
+
+#include <string>
+#include <multi_img.h>
+#include "imginput_config.h"
+
+namespace imginput {
+
+/// reader for uncompressed ENVI images (.hdr file and raw data file)
+/**
+	The header is parsed directly and the data file is memory-mapped, see
+	multi_img_mapped. Only the requested region of interest and bands are
+	converted, in parallel. Data values are kept, like in GdalReader.
+  */
+class EnviReader {
+public:
+	EnviReader(const ImgInputConfig& config)
+		: config(config) { }
+
+	/// returns empty image if file is no (supported) ENVI image
+	multi_img::ptr readFile();
+
+	/// maps the image without reading it, returns NULL on failure
+	/** Bands are sorted by wavelength, data values are kept. The value range
+		is the smallest one readFile() assumes, the caller has to widen it to
+		the data. Caller takes ownership. **/
+	static multi_img_mapped* open(const std::string &file);
+
+	/// true if file is an ENVI header or has one next to it
+	static bool probe(const std::string &file);
+
+	/// determine header and data file names from either of them
+	static bool findFiles(const std::string &file,
+	                      std::string &header, std::string &data);
+
+private:
+	const ImgInputConfig &config;
+};
+
+} // namespace
+
+#endif // ENVIREADER_H
@@ -179,7 +179,7 @@ multi_img::ptr GdalReader::readFile()
 	int sizeY = dataset->GetRasterYSize();
 	if (!config.roi.empty())
 	{
-		// Do not print an error message here, as it will be printed in ImgInput anyways
+		// invalid specifications are rejected by ImgInput beforehand
 		std::vector<int> roiVals;
 		if (ImgInput::parseROIString(config.roi, roiVals))
 		{
@@ -1,6 +1,10 @@
 #include "imginput.h"
 #include "gdalreader.h"
-#include <multi_img/illuminant.h>
+#include "envireader.h"
+#include <derived_cache.h>
+#include <multi_img_mapped.h>
+#include <multi_img_tiled.h>
+#include <sstream>
 #include <string>
 #include <vector>
 #include <boost/make_shared.hpp>
@@ -15,66 +19,117 @@ multi_img::ptr ImgInput::execute()
 		return multi_img::ptr(new multi_img()); // empty image
 	}
 
-	bool roiChanged = false;
-	bool bandsCropped = false;
-
-	multi_img::ptr img_ptr;
-	// try GDAL first as it is better for some formats OpenCV reads, too (e.g. TIFF)
-#ifdef WITH_GDAL
-	img_ptr = GdalReader(config).readFile();
-#endif
-	
-	if (img_ptr && !img_ptr->empty()) {
-		// GdalReader was used successfully, applied roiChanges & bandCropping
-		roiChanged = true;
-		bandsCropped = true;
-	} else {
-		// GDAL failed, try internal method
-		img_ptr = multi_img::ptr(new multi_img(config.file));
+	/* preprocessing is costly, reuse a previous result for the same input
+	   file and settings */
+	DerivedCache cache;
+	DerivedCache::Key cacheKey;
+	if (cache.enabled() && (config.normalize || config.gradient
+	                        || config.removeIllum > 0 || config.addIllum > 0
+	                        || config.bands > 0)) {
+		std::ostringstream params;
+		params << "imginput " << config.roi << " " << config.bandlow << " "
+		       << config.bandhigh << " " << config.normalize << " "
+		       << config.gradient << " " << config.bands << " "
+		       << config.removeIllum << " " << config.addIllum;
+		cacheKey = DerivedCache::key(
+		            DerivedCache::inputFingerprint(inputFiles(config.file)),
+		            params.str());
+
+		multi_img::ptr cached(new multi_img());
+		if (cache.load(cacheKey, *cached)) {
+			std::cout << "Using cached preprocessed image." << std::endl;
+			if (!config.writeCube.empty())
+				cached->write_cube(config.writeCube);
+			return cached;
+		}
 	}
 
-	// return empty image if both failed
-	if (img_ptr->empty())
-		return img_ptr;
+	// no reader shall fall back to the whole image
+	std::vector<int> roiVals;
+	if (!config.roi.empty() && !parseROIString(config.roi, roiVals)) {
+		std::cerr << "Invalid ROI specification " << config.roi
+		          << ", expected x:y:width:height" << std::endl;
+		return multi_img::ptr(new multi_img()); // empty image
+	}
 
-	// apply ROI
-	if (!roiChanged && !config.roi.empty())
-	{
-		std::vector<int> roiVals;
-		if (!ImgInput::parseROIString(config.roi, roiVals)) {
-			// Parsing of ROI String failed
-			std::cerr << "Ignoring invalid ROI specification" << std::endl;
-		} else {
-			applyROI(*img_ptr, roiVals);
+	multi_img::Preprocessing steps;
+	steps.normalize = config.normalize;
+	steps.gradient = config.gradient;
+	steps.bands = config.bands;
+	steps.removeIllum = config.removeIllum;
+	steps.addIllum = config.addIllum;
+
+	/* a native cube file that is preprocessed into a cube file goes through
+	   in stripes, only the result is loaded */
+	if (!config.writeCube.empty() && config.writeCube != config.file
+	    && config.roi.empty() && config.bandlow == 0 && config.bandhigh == 0
+	    && (steps.normalize || steps.gradient || steps.removeIllum > 0
+	        || steps.addIllum > 0 || steps.bands > 0)) {
+		multi_img_mapped *source = multi_img::open_cube(config.file);
+		if (source) {
+			multi_img_cube_sink sink(config.writeCube);
+			bool success = multi_img_tiled(*source).run(
+				[&steps](multi_img &stripe) {
+					multi_img result;
+					stripe.preprocess(steps, result);
+					stripe = result;
+				}, sink);
+			delete source;
+
+			multi_img::ptr result(new multi_img());
+			if (!success || !result->read_image_cube(config.writeCube))
+				return multi_img::ptr(new multi_img()); // empty image
+			if (!cacheKey.empty())
+				cache.store(cacheKey, *result);
+			return result;
 		}
 	}
 
-	// crop spectrum - maybe we used a fancy file reader that cropped the bands already
-	if (!bandsCropped)
-		cropSpectrum(*img_ptr);
+	multi_img::ptr img_ptr;
+	// ENVI images are mapped and converted natively, only what is needed
+	if (EnviReader::probe(config.file))
+		img_ptr = EnviReader(config).readFile();
 
-	// return empty image on failure
-	if (img_ptr->empty())
-		return img_ptr;
+	// try GDAL next as it is better for some formats OpenCV reads, too (e.g. TIFF)
+	// native cube files are read directly through mmap, skip probing GDAL
+#ifdef WITH_GDAL
+	if ((!img_ptr || img_ptr->empty()) && !multi_img::probe_cube(config.file))
+		img_ptr = GdalReader(config).readFile();
+#endif
+	
+	// GdalReader, if used successfully, applied ROI & band cropping
+	if (!img_ptr || img_ptr->empty()) {
+		// GDAL failed, try internal method, also reading only ROI and bands
+		cv::Rect roi;
+		if (!config.roi.empty())
+			roi = cv::Rect(roiVals[0], roiVals[1], roiVals[2], roiVals[3]);
+		// if bandhigh is not specified, do not limit
+		int bandhigh = (config.bandhigh == 0) ? -1 : config.bandhigh;
 
-	// normalize L2 magnitudes
-	if (config.normalize) {
-		img_ptr->normalize_magnitudes();
+		img_ptr = multi_img::ptr(new multi_img());
+		img_ptr->read_image(config.file, roi, config.bandlow, bandhigh);
 	}
 
-	// compute gradient
-	if (config.gradient) {
-		img_ptr->apply_logarithm();
-		*img_ptr = img_ptr->spec_gradient();
-	}
+	// return empty image if both failed
+	if (img_ptr->empty())
+		return img_ptr;
 
-	// reduce number of bands
-	if (config.bands > 0 && config.bands < (int)img_ptr->size()) {
-		*img_ptr = img_ptr->spec_rescale(config.bands);
+	// normalize, compute gradient, reduce number of bands and alter
+	// illumination in one pass
+	if (steps.normalize || steps.gradient || steps.removeIllum > 0
+	    || steps.addIllum > 0
+	    || (steps.bands > 0 && steps.bands < (int)img_ptr->size())) {
+		multi_img::ptr result(new multi_img());
+		img_ptr->preprocess(steps, *result);
+		img_ptr = result;
+
+		if (!cacheKey.empty())
+			cache.store(cacheKey, *img_ptr);
 	}
 
-	// alter illumination
-	applyIllumination(*img_ptr);
+	// store preprocessed image for fast reloading
+	if (!config.writeCube.empty())
+		img_ptr->write_cube(config.writeCube);
 
 	return img_ptr;
 }
@@ -86,6 +141,30 @@ multi_img::ptr ImgInput::load(const std::string &filename)
 	return ImgInput(cfg).execute();
 }
 
+multi_img_base* ImgInput::open(const std::string &filename)
+{
+	if (EnviReader::probe(filename))
+		return EnviReader::open(filename);
+	if (multi_img::probe_cube(filename))
+		return multi_img::open_cube(filename);
+	return NULL;
+}
+
+std::vector<std::string> ImgInput::inputFiles(const std::string &filename)
+{
+	std::vector<std::string> ret(1, filename);
+	std::string header, data;
+	if (EnviReader::probe(filename)
+	    && EnviReader::findFiles(filename, header, data)) {
+		ret[0] = header;
+		ret.push_back(data);
+		return ret;
+	}
+	std::vector<std::string> listed = multi_img::parse_filelist(filename).first;
+	ret.insert(ret.end(), listed.begin(), listed.end());
+	return ret;
+}
+
 bool ImgInput::parseROIString(const std::string &str, std::vector<int> &vals)
 {
 	int ctr = 0;
@@ -99,45 +178,4 @@ bool ImgInput::parseROIString(const std::string &str, std::vector<int> &vals)
 	return ctr == 3;
 }
 
-void ImgInput::applyROI(multi_img &img, std::vector<int>& vals)
-{
-	img = multi_img(img, cv::Rect(vals[0], vals[1], vals[2], vals[3]));
-}
-
-void ImgInput::cropSpectrum(multi_img& img)
-{
-	if ((config.bandlow > 0) ||
-		(config.bandhigh > 0 && config.bandhigh < (int)img.size() - 1)) {
-
-		// if bandhigh is not specified, do not limit
-		int bandhigh =
-		        (config.bandhigh == 0) ? (img.size() - 1) : config.bandhigh;
-
-		// correct input?
-		if (config.bandlow > bandhigh || bandhigh > (int)img.size() - 1) {
-			std::cerr << "Inconsistent bandlow, bandhigh values specified!"
-			          << std::endl;
-			img = multi_img();
-			return;
-		}
-
-        img = multi_img(img, config.bandlow, bandhigh);
-	}
-}
-
-void ImgInput::applyIllumination(multi_img &img)
-{
-	if (config.removeIllum > 0) {
-		Illuminant il(config.removeIllum);
-		// first get normalization right for our range
-		il.setNormalization(img.meta[0].center, img.meta[img.size()-1].center);
-		img.apply_illuminant(il, true);
-	}
-	if (config.addIllum > 0) {
-		Illuminant il(config.addIllum);
-		il.setNormalization(img.meta[0].center, img.meta[img.size()-1].center);
-		img.apply_illuminant(il);
-	}
-}
-
 } //namespace
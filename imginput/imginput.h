@@ -16,16 +16,19 @@ public:
 	// convenience method for most simple case
 	static multi_img::ptr load(const std::string& filename);
 
+	/// maps an ENVI or native cube file without reading it
+	/** Returns NULL for other formats. No roi, band selection or
+		preprocessing is applied, the value range of ENVI data is not yet
+		fitted, see EnviReader::open(). Caller takes ownership. **/
+	static multi_img_base* open(const std::string& filename);
+
 	static bool parseROIString(const std::string &str, std::vector<int> &vals);
 
+	/// all files the image in filename is read from, e.g. for DerivedCache
+	static std::vector<std::string> inputFiles(const std::string &filename);
+
 private:
 	const ImgInputConfig &config;
-
-	void applyROI(multi_img &img, std::vector<int> &vals);
-
-	void cropSpectrum(multi_img &img);
-
-	void applyIllumination(multi_img& img_ptr);
 };
 
 } // namespace
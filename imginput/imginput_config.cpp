@@ -45,6 +45,7 @@ DESC_OPT(bandlow, "Select bands and use band index as lower bound (if >0)")
 DESC_OPT(bandhigh, "Select bands and use band index as upper bound (if >0)")
 DESC_OPT(removeIllum, "Remove black body illuminant specified in Kelvin (if >0)")
 DESC_OPT(addIllum, "Add black body illuminant specified in Kelvin (if >0)")
+DESC_OPT(writeCube, "Write preprocessed image to a native cube file for fast reloading")
 }
 
 std::string ImgInputConfig::getString() const {
@@ -62,6 +63,7 @@ std::string ImgInputConfig::getString() const {
 	COMMENT_OPT(s, bandhigh);
 	COMMENT_OPT(s, removeIllum);
 	COMMENT_OPT(s, addIllum);
+	COMMENT_OPT(s, writeCube);
 
 	return s.str();
 }
@@ -78,6 +80,7 @@ void ImgInputConfig::initBoostOptions() {
 			BOOST_OPT(bandhigh)
 			BOOST_OPT(removeIllum)
 			BOOST_OPT(addIllum)
+			BOOST_OPT(writeCube)
 	;
 
 }
@@ -40,6 +40,9 @@ public:
 	// Add blackbody illuminant with X Kelvin
 	int addIllum;
 
+	// write preprocessed image to native cube file (if not empty)
+	std::string writeCube;
+
 
 	virtual std::string getString() const;
 
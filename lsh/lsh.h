@@ -50,7 +50,9 @@ class LSH
 	typedef vector< vector<Entry> > Htable;
 
 public:
-	LSH(const vector<vector<data_t> > &data, int K, int L,
+	/// data holds npoints points of dims values each, one after the other
+	/// (e.g. a continuous npoints x dims matrix), and must outlive the LSH
+	LSH(const data_t *data, unsigned int npoints, int dims, int K, int L,
 		bool dataDrivenPartitions = true,
 		const vector<unsigned int> &subSet = vector<unsigned int>());
 
@@ -63,7 +65,10 @@ private:
 	/// members:
 
 	/// interleaved data points
-	const vector<vector<data_t> > &data;
+	const data_t *data;
+
+	/// number of data points
+	const unsigned int npoints;
 
 	/// number of dimensions
 	const int dims;
@@ -89,6 +94,10 @@ private:
 	vector< vector<cut_t> > partitions;
 	vector<int> hashCoeffs;
 
+	/// coordinates of an existing data point
+	const data_t *point(unsigned int p) const
+	{ return data + (size_t)p * dims; }
+
 	/// return random number in [0;size)
 	int random(int max) const;
 
@@ -102,7 +111,7 @@ private:
 	void fillTable();
 
 	/// determine boolean vector for given coordinates in a certain partition
-	std::vector<bool> getBoolVec(const std::vector<data_t> &point,
+	std::vector<bool> getBoolVec(const data_t *point,
 								 const partition_t &part) const;
 
 	/// determine boolean vector for an existing point in a certain partition
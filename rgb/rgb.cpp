@@ -75,7 +75,7 @@ std::map<std::string, boost::any> RGBDisplay::execute(
 		if ((**src).empty())
 			assert(false);
 
-		// copy, see above
+		// copy, see above (cheap, data is shared until written)
 		srcimg = new multi_img(**src);
 	}
 
@@ -120,7 +120,8 @@ cv::Mat3f RGBDisplay::executePCA(const multi_img& src, ProgressObserver *po)
 {
 	// cover cases of lt 3 channels
 	unsigned int components = std::min((size_t)3, src.size());
-	multi_img pca3 = src.project(src.pca(components));
+	// covariance from a subsample is plenty for a false-color image
+	multi_img pca3 = src.project(src.pca(components, 1 << 18, true));
 
 	bool cont = (!po) || po->update(.7f); // TODO: values
 	if (!cont) return cv::Mat3f();
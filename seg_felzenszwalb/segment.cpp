@@ -41,16 +41,18 @@ std::pair<cv::Mat1i, segmap> segment_image(const multi_img &im,
 	std::vector<float> weights;
 	
 	int num = 0;
+	// distance functions work on vectors, reuse buffers for all pixels
+	multi_img::Pixel p1, p2;
 	for (int y = 0; y < height; y++) {
 		for (int x = 0; x < width; x++) {
 			cv::Point coord1(x, y);
-			const multi_img::Pixel &p1 = im(coord1);
+			im(coord1).copyTo(p1);
 
 			if (x < width-1) {
 				edges[num].a = y * width + x;
 				edges[num].b = y * width + (x+1);
 				cv::Point coord2(x+1, y);
-				const multi_img::Pixel &p2 = im(coord2);
+				im(coord2).copyTo(p2);
 				weights.push_back((float)distfun->
 								  getSimilarity(p1, p2, coord1, coord2));
 				num++;
@@ -60,7 +62,7 @@ std::pair<cv::Mat1i, segmap> segment_image(const multi_img &im,
 				edges[num].a = y * width + x;
 				edges[num].b = (y+1) * width + x;
 				cv::Point coord2(x, y+1);
-				const multi_img::Pixel &p2 = im(coord2);
+				im(coord2).copyTo(p2);
 				weights.push_back((float)distfun->getSimilarity(p1, p2, coord1, coord2));
 				num++;
 			}
@@ -69,7 +71,7 @@ std::pair<cv::Mat1i, segmap> segment_image(const multi_img &im,
 				edges[num].a = y * width + x;
 				edges[num].b = (y+1) * width + (x+1);
 				cv::Point coord2(x+1, y+1);
-				const multi_img::Pixel &p2 = im(coord2);
+				im(coord2).copyTo(p2);
 				weights.push_back((float)distfun->getSimilarity(p1, p2, coord1, coord2));
 				num++;
 			}
@@ -78,7 +80,7 @@ std::pair<cv::Mat1i, segmap> segment_image(const multi_img &im,
 				edges[num].a = y * width + x;
 				edges[num].b = (y-1) * width + (x+1);
 				cv::Point coord2(x+1, y-1);
-				const multi_img::Pixel &p2 = im(coord2);
+				im(coord2).copyTo(p2);
 				weights.push_back((float)distfun->getSimilarity(p1, p2, coord1, coord2));
 				num++;
 			}
@@ -26,8 +26,8 @@ void ipp(const multi_img& input)
 	int z = 0, n = 0, l = 0;
 	for (int y = 0; y < input.height; ++y) {
 		for (int x = 0; x < input.width; ++x, ++n, ++l) {
-			const multi_img::Pixel &p = input(y, x);
-			const cv::Mat1f v(p, false);
+			multi_img::PixelView p = input(y, x);
+			const cv::Mat1f v = multi_img::toMat(p);
 
 			// fill Z
 			for (int k = 0; k < p.size(); ++k, ++z) {
@@ -39,7 +39,7 @@ void ipp(const multi_img& input)
 			// fill D and L
 			float degree = 0.f;
 			if (y > 0) {
-				cv::Mat1f v2(input(y-1, x), false);
+				cv::Mat1f v2 = multi_img::toMat(input(y-1, x));
 				float w = cv::norm(v, v2, cv::NORM_L2);
 				degree += w;
 				L2->x[l] = -w;
@@ -48,7 +48,7 @@ void ipp(const multi_img& input)
 				l++;
 			}
 			if (x > 0) {
-				cv::Mat1f v2(input(y, x-1), false);
+				cv::Mat1f v2 = multi_img::toMat(input(y, x-1));
 				float w = cv::norm(v, v2, cv::NORM_L2);
 				degree += w;
 				L2->x[l] = -w;
@@ -57,7 +57,7 @@ void ipp(const multi_img& input)
 				l++;
 			}
 			if (y < input.height - 1) {
-				cv::Mat1f v2(input(y+1, x), false);
+				cv::Mat1f v2 = multi_img::toMat(input(y+1, x));
 				float w = cv::norm(v, v2, cv::NORM_L2);
 				degree += w;
 				L2->x[l] = -w;
@@ -66,7 +66,7 @@ void ipp(const multi_img& input)
 				l++;
 			}
 			if (x < input.width - 1) {
-				cv::Mat1f v2(input(y, x+1), false);
+				cv::Mat1f v2 = multi_img::toMat(input(y, x+1));
 				float w = cv::norm(v, v2, cv::NORM_L2);
 				degree += w;
 				L2->x[l] = -w;
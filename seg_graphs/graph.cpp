@@ -284,6 +284,7 @@ void Graph::color_standard_weights(const multi_img & image,
 	}
 
 	// import edge coloring from image
+	multi_img::Pixel p1, p2; // buffers for distance function input
 	for (unsigned int i = 0; i < edges.size(); i++) {
 		// hackish! rewrite edges code! width == number of columns
 		cv::Point coord1(edges[i].nodes[0] % width, edges[i].nodes[0] / width),
@@ -292,7 +293,8 @@ void Graph::color_standard_weights(const multi_img & image,
 		if (gray) {
 			edges[i].weight = std::abs(band0(coord1) - band0(coord2));
 		} else {
-			const multi_img::Pixel &p1 = image(coord1), &p2 = image(coord2);
+			image(coord1).copyTo(p1);
+			image(coord2).copyTo(p2);
 			edges[i].weight = (float)distfun->getSimilarity(p1, p2, coord1, coord2);
 			max_weight = std::max<float>(edges[i].weight, max_weight);
 		}
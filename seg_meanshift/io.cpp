@@ -57,18 +57,18 @@ bool FAMS::loadPoints(char* filename) {
 	}
 
 	// dataholder holds all the data, points only reference it w/ pointers
-	dataholder.assign(temp.size(), std::vector<unsigned short>(temp[0].size()));
+	dataholder.create((int)temp.size(), (int)temp[0].size());
 
 	for (size_t i = 0; i < temp.size(); ++i) {
 		for (size_t j = 0; j < temp[i].size(); ++j) {
-			dataholder[i][j] = value2ushort<unsigned short>(temp[i][j]);
+			dataholder((int)i, (int)j) = value2ushort<unsigned short>(temp[i][j]);
 		}
 	}
 
 	// link points to their data
-	datapoints.resize(dataholder.size());
-	for (size_t i = 0; i < dataholder.size(); ++i) {
-		datapoints[i].data = &dataholder[i];
+	datapoints.resize(dataholder.rows);
+	for (int i = 0; i < dataholder.rows; ++i) {
+		datapoints[i].data = dataholder[i];
 	}
 	bgLog("done\n");
 	return true;
@@ -85,14 +85,16 @@ bool FAMS::importPoints(const multi_img& img) {
 	minVal_ = img.minval;
 	maxVal_ = img.maxval;
 
-	// let multi_img do the hard work
-	dataholder = img.export_ushort(true);
+	/* let multi_img do the hard work. its result is shared with other
+	   users and not copied, points only reference its rows */
+	dataholder = img.export_ushort_mat(true);
+	if (!dataholder.isContinuous())
+		dataholder = dataholder.clone();
 
 	// link points to their data
-	datapoints.resize(dataholder.size());
-	for (size_t i = 0; i < dataholder.size(); ++i) {
-		datapoints[i].data = &dataholder[i];
-	}
+	datapoints.resize(dataholder.rows);
+	for (int i = 0; i < dataholder.rows; ++i)
+		datapoints[i].data = dataholder[i];
 	bgLog("done\n");
 	return true;
 }
@@ -155,6 +157,7 @@ void FAMS::saveModeImg(const std::string& filename, bool pruned,
 	multi_img dest(h, w, modes[0].data.size());
 	dest.minval = minVal_;
 	dest.maxval = maxVal_;
+	dest.prepareWrite();
 	for (int y = 0; y < h; ++y) {
 		for (int x = 0; x < w; ++x) {
 			multi_img::Pixel px(dest.size());
@@ -179,10 +182,11 @@ void FAMS::dbgSavePoints(const std::string& filebase,
 	multi_img dest((int)points.size(), 1, d_);
 	dest.minval = minVal_;
 	dest.maxval = maxVal_;
+	dest.prepareWrite();
 	for (size_t x = 0; x < points.size(); ++x) {
 		multi_img::Pixel px(d_);
 		for (unsigned int d = 0; d < d_; ++d)
-			px[d] = ushort2value((*points[x].data)[d]);
+			px[d] = ushort2value(points[x].data[d]);
 		dest.setPixel(x, 0, px);
 	}
 
@@ -160,7 +160,8 @@ std::vector<FAMS::Point> MeanShift::prepare_sp_points(const FAMS &fams,
 	for (mit = map.begin(); mit != map.end(); ++mit) {
 		// initialize new point with zero
 		FAMS::Point p;
-		p.data = new std::vector<unsigned short>(D);
+		unsigned short *data = new unsigned short[D];
+		p.data = data;
 		p.window = 0;
 		p.weightdp2 = 0.;
 
@@ -171,14 +172,14 @@ std::vector<FAMS::Point> MeanShift::prepare_sp_points(const FAMS &fams,
 		for (int i = 0; i < N; ++i) {
 			int coord = (*mit)[i];
 			for (int d = 0; d < D; ++d)
-				accum[d] += (*points[coord].data)[d];
+				accum[d] += points[coord].data[d];
 			p.window = std::max(p.window, points[coord].window);
 			p.weightdp2 += points[coord].weightdp2;
 		}
 
 		// divide by N to obtain average
 		for (int d = 0; d < D; ++d)
-			(*p.data)[d] = accum[d] / N;
+			data[d] = accum[d] / N;
 		p.weightdp2 /= (double)N;
 
 		// add to point set
@@ -208,7 +209,7 @@ cv::Mat1s MeanShift::segmentImageSP(const FAMS &fams, const cv::Mat1i &lookup)
 void MeanShift::cleanup_sp_points(std::vector<FAMS::Point> &points)
 {
 	for (size_t i = 0; i < points.size(); ++i)
-		delete points[i].data;
+		delete[] points[i].data;
 }
 
 #endif
@@ -37,9 +37,7 @@ int MeanShiftShell::execute() {
 #ifdef WITH_SEG_FELZENSZWALB
 	if (config.sp_withGrad) {
 		input = imginput::ImgInput(config.input).execute();
-		input_grad = multi_img::ptr(new multi_img(*input, true));
-		input_grad->apply_logarithm();
-		*input_grad = input_grad->spec_gradient();
+		input_grad = multi_img::ptr(new multi_img(input->log_gradient()));
 	} else
 #endif
     {
@@ -41,9 +41,7 @@ int MeanShiftSP::execute()
 	multi_img::ptr input, input_grad;
 	if (config.sp_withGrad) {
 		input = imginput::ImgInput(config.input).execute();
-		input_grad = multi_img::ptr(new multi_img(*input, true));
-		input_grad->apply_logarithm();
-		*input_grad = input_grad->spec_gradient();
+		input_grad = multi_img::ptr(new multi_img(input->log_gradient()));
 	} else {
 		input = imginput::ImgInput(config.input).execute();
 	}
@@ -153,6 +151,7 @@ MeanShift::Result MeanShiftSP::execute(multi_img::ptr input, multi_img::ptr inpu
 	msinput.minval = in->minval;
 	msinput.maxval = in->maxval;
 	msinput.meta = in->meta;
+	msinput.prepareWrite();
 	vector<double> weights(sp_map.size());
 	std::vector<int> spsizes; // HACK
 	seg_felzenszwalb::segmap::const_iterator mit = sp_map.begin();
@@ -164,7 +163,7 @@ MeanShift::Result MeanShiftSP::execute(multi_img::ptr input, multi_img::ptr inpu
 
 		// sum up all superpixel members
 		for (int i = 0; i < N; ++i) {
-			const multi_img::Pixel &s = in->atIndex((*mit)[i]);
+			multi_img::PixelView s = in->atIndex((*mit)[i]);
 			for (int d = 0; d < D; ++d)
 				p[d] += s[d];
 		}
@@ -211,7 +211,7 @@ void FAMS::ComputeScores(float* scores, LSHReader &lsh, int L) {
 		int numns[max_win / win_j];
 		memset(numns, 0, sizeof(numns));
 
-		lsh.query(*startPoints[j]->data);
+		lsh.query(startPoints[j]->data);
 		const std::vector<unsigned int>& lshResult = lsh.getResult();
 		const std::vector<int>& num_l = lsh.getNumByPartition();
 
@@ -265,8 +265,8 @@ unsigned int FAMS::DoMSAdaptiveIteration(const std::vector<unsigned int> *res,
 			double x = 1.0 - (dist / ptp.window);
 			double w = ptp.weightdp2 * x * x;
 			total_weight += w;
-			for (size_t j = 0; j < ptp.data->size(); j++)
-				rr[j] += (*ptp.data)[j] * w;
+			for (size_t j = 0; j < d_; j++)
+				rr[j] += ptp.data[j] * w;
 			if (dist < hmdist) {
 				hmdist = dist;
 				crtH   = ptp.window;
@@ -302,7 +302,7 @@ const
 		crtWindow  = &fams.modes[jj].window;
 		// set initial values
 		Point *p = fams.startPoints[jj];
-		crtMean    = *p->data;
+		crtMean.assign(p->data, p->data + fams.d_);
 		*crtWindow = p->window;
 
 		for (int iter = 0; oldMean != crtMean && (iter < FAMS_MAXITER);
@@ -491,7 +491,7 @@ KLResult FAMS::FindKL() {
 
 
 int64 FAMS::DoFindKLIteration(int K, int L, float* scores) {
-	LSH lsh(dataholder, d_, K, L);
+	LSH lsh(dataholder[0], dataholder.rows, d_, K, L);
 	LSHReader lshreader(lsh);
 
 	// Compute Scores
@@ -506,7 +506,7 @@ bool FAMS::prepareFAMS(vector<double> *bandwidths) {
 
 	if (config.use_LSH) {
 		bgLog("Running FAMS with K=%d L=%d\n", config.K, config.L);
-		lsh_ = new LSH(dataholder, d_, config.K, config.L);
+		lsh_ = new LSH(dataholder[0], dataholder.rows, d_, config.K, config.L);
 	} else {
 		bgLog("Running FAMS without LSH (try --useLSH)\n");
 	}
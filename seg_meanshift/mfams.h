@@ -69,7 +69,8 @@ class FAMS
 public:
 
 	struct Point {
-		std::vector<unsigned short> *data;
+		// d_ values, a row of dataholder or owned by the creator of the point
+		const unsigned short *data;
 		// size of ms window around this point (L1)
 		unsigned int   window;
 		double         weightdp2;
@@ -189,11 +190,11 @@ public:
 	{
 		size_t i = 0;
 		unsigned int ret = 0;
-		if (in_pt1.data->size() > 7) {
+		if (d_ > 7) {
 			__m128i vret = _mm_setzero_si128(), vzero = _mm_setzero_si128();
-			for (; i < in_pt1.data->size() - 8; i += 8) {
-				unsigned short *p1 = &(*in_pt1.data)[i];
-				unsigned short *p2 = &(*in_pt2.data)[i];
+			for (; i < d_ - 8; i += 8) {
+				const unsigned short *p1 = in_pt1.data + i;
+				const unsigned short *p2 = in_pt2.data + i;
 				__m128i vec1 = _mm_loadu_si128((__m128i*)p1);
 				__m128i vec2 = _mm_loadu_si128((__m128i*)p2);
 				__m128i v1i1 = _mm_unpacklo_epi16(vec1, vzero);
@@ -214,8 +215,8 @@ public:
 			ret += unpack->i[2];
 			ret += unpack->i[3];
 		}
-		for (; i < in_pt1.data->size(); i++) {
-			ret += abs((*in_pt1.data)[i] - (*in_pt2.data)[i]);
+		for (; i < d_; i++) {
+			ret += abs(in_pt1.data[i] - in_pt2.data[i]);
 		}
 
 		return ret;
@@ -233,7 +234,7 @@ public:
 		in_res = 0;
 		for (size_t in_i = 0;
 			 in_i < in_d1.size() && (in_res < in_dist); in_i++)
-			in_res += abs(in_d1[in_i] - (*in_pt2.data)[in_i]);
+			in_res += abs(in_d1[in_i] - in_pt2.data[in_i]);
 		return (in_res < in_dist);
 	}
 
@@ -274,7 +275,8 @@ protected:
 	std::vector<Point> datapoints;
 
 	// input data, in case we need to store it ourselves
-	std::vector<std::vector<unsigned short> > dataholder;
+	// one point per row, continuous as the LSH reads it as one array
+	cv::Mat_<unsigned short> dataholder;
 
 	// selected points on which MS is run
 	std::vector<Point*> startPoints;
@@ -5,10 +5,13 @@
 
 #include <similarity_measure.h>
 #include <sm_factory.h>
+#include <derived_cache.h>
 
 #include <opencv2/highgui/highgui.hpp> // for debug writeout
 #include <boost/cstdint.hpp>
 #include <boost/filesystem.hpp>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
 #include <fstream>
 #include <algorithm>
 #include <functional>
@@ -45,10 +48,11 @@ void GenSOM::train(const multi_img &input, ProgressObserver *po)
 
 	cv::MatConstIterator_<int> itY = shuffledY.begin();
 	cv::MatConstIterator_<int> itX = shuffledX.begin();
+	multi_img::Pixel vec; // sample buffer, reused in every iteration
 	for (int curIter = 0; curIter < maxIter; ++curIter, ++itX, ++itY)
 	{
 		// feed one sample
-		const multi_img::Pixel &vec = input(*itY, *itX);
+		input(*itY, *itX).copyTo(vec);
 		sumOfUpdates += trainSingle(vec, curIter, maxIter);
 
 		// print progress (and maybe exit)
@@ -251,8 +255,37 @@ GenSOM *GenSOM::create(const SOMConfig &conf, const multi_img &img,
 					  << "does not exist. Starting training."
 					  << std::endl;
 		}
+		/* without a file given, reuse a SOM trained earlier on the same
+		   data with the same settings */
+		DerivedCache cache;
+		DerivedCache::Key key;
+		if (conf.somFile.empty() && cache.enabled()) {
+			std::stringstream params;
+			params << "som " << img.size() << " " << conf.getString();
+			key = DerivedCache::key(DerivedCache::imageFingerprint(img),
+			                        params.str());
+			if (cache.contains(key, "som")) {
+				std::cout << "# loading SOM from cache" << std::endl;
+				try {
+					return loadFile(cache.path(key, "som"), conf);
+				} catch (const std::exception &e) {
+					std::cerr << "# ignoring invalid cached SOM: "
+					          << e.what() << std::endl;
+				}
+			}
+		}
+
 		som = create(conf, img.size(), /* randomize */ true);
 		som->train(img, po);
+
+		if (!key.empty()) {
+			try {
+				som->saveFile(cache.tempPath(key, "som"));
+				cache.commit(key, "som");
+			} catch (const std::exception &e) {
+				std::cerr << "# could not cache SOM: " << e.what() << std::endl;
+			}
+		}
 	}
 	return som;
 }
@@ -428,12 +461,39 @@ multi_img GenSOM::img(const std::vector<multi_img_base::BandDesc> &meta,
 	multi_img ret(size.height, size.width, neurons[0].size());
 	ret.meta = meta;
 	ret.minval = range.min; ret.maxval = range.max;
+	ret.prepareWrite();
 	for (size_t i = 0; i < neurons.size(); ++i) {
 		ret.setPixel(getCoord2D(i), neurons[i]);
 	}
 	return ret;
 }
 
+void GenSOM::quantize(multi_img &img) const
+{
+	multi_img ret(img.height, img.width, img.size());
+	ret.meta = img.meta;
+	ret.minval = img.minval; ret.maxval = img.maxval;
+
+	/* write the bands of ret directly, its pixel cache is rebuilt from them
+	   anyways */
+	const size_t D = img.size();
+	img.rebuildPixels();
+	tbb::parallel_for(tbb::blocked_range<int>(0, img.height),
+		[&](const tbb::blocked_range<int> &r) {
+			multi_img::Pixel pixel; // reused for all pixels in range
+			for (int y = r.begin(); y != r.end(); ++y) {
+				for (int x = 0; x < img.width; ++x) {
+					img(y, x).copyTo(pixel);
+					const Neuron &n = neurons[findBMU(pixel).index];
+					for (size_t d = 0; d < D; ++d)
+						ret.bands[d](y, x) = n[d];
+				}
+			}
+		});
+	ret.resetPixels();
+	img = ret;
+}
+
 cv::Mat3f GenSOM::bgr(const std::vector<multi_img_base::BandDesc> &meta,
 					  multi_img_base::Value maxval)
 {
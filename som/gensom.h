@@ -164,6 +164,12 @@ public:
 	multi_img img(const std::vector<multi_img_base::BandDesc> &meta,
 				  const multi_img_base::Range &range);
 
+	/** Replace each pixel of img by its best matching unit.
+	 *
+	 * Works on any part of an image, e.g. as operation of multi_img_tiled.
+	 */
+	void quantize(multi_img &img) const;
+
 	/** Compute RGB representation of SOM in 2D (useful for debugging) */
 	cv::Mat3f bgr(const std::vector<multi_img::BandDesc> &meta,
 				  multi_img::Value maxval);
@@ -17,9 +17,10 @@ public:
 		// iterate over all pixels in range
 		float done = 0;
 		float total = (o.height * o.width);
+		multi_img::Pixel pixel; // reused for all pixels in range
 		for (int y = r.rows().begin(); y < r.rows().end(); ++y) {
 			for (int x = r.cols().begin(); x < r.cols().end(); ++x) {
-				const multi_img::Pixel& pixel = img(y,x);
+				img(y,x).copyTo(pixel);
 				const size_t roff = o.roff(x,y);
 				o.som.findClosestN(pixel,
 									o.results.begin() + roff,
@@ -50,6 +51,8 @@ SOMClosestN::SOMClosestN(GenSOM const& som, multi_img const& img, int n,
 	  results(height * width * n),
 	  po(po)
 {
+	// dirty tiles must not be rebuilt concurrently inside the loop
+	img.rebuildPixels();
 	tbb::parallel_for(tbb::blocked_range2d<int>(0, img.height, // row range
 												0, img.width), // column range
 					  ClosestNTbb(*this, img));